@@ -7,7 +7,6 @@
 #include "../Utils/Constants.h"
 #include "../Utils/Data.h"
 
-#include "../ThirdParty/BigIntHeader.hpp"
 #include "ethsnarks.hpp"
 #include "utils.hpp"
 
@@ -231,6 +230,8 @@ class BaseTransactionCircuit : public GadgetT
 {
   public:
     const TransactionState &state;
+    // The variables of a transaction circuit are allocated one after the other, starting here
+    const libsnark::var_index_t firstVariable;
 
     std::map<TxVariable, VariableT> uOutputs;
     std::map<TxVariable, VariableArrayT> aOutputs;
@@ -239,7 +240,7 @@ class BaseTransactionCircuit : public GadgetT
       ProtoboardT &pb,
       const TransactionState &_state,
       const std::string &prefix)
-        : GadgetT(pb, prefix), state(_state)
+        : GadgetT(pb, prefix), state(_state), firstVariable(pb.num_variables() + 1)
     {
         aOutputs[TXV_STORAGE_A_ADDRESS] = VariableArrayT(NUM_BITS_STORAGE_ADDRESS, state.constants._0);
         uOutputs[TXV_STORAGE_A_DATA] = state.accountA.storage.data;
@@ -324,6 +325,27 @@ class BaseTransactionCircuit : public GadgetT
     virtual const VariableArrayT getPublicData() const = 0;
 };
 
+// A transaction circuit that also records where its variables end, so all variables the
+// circuit allocates are in [firstVariable, endVariable)
+template <typename CircuitT> class AllocatedCircuit : public CircuitT
+{
+  public:
+    const libsnark::var_index_t endVariable;
+
+    AllocatedCircuit( //
+      ProtoboardT &pb,
+      const TransactionState &state,
+      const std::string &prefix)
+        : CircuitT(pb, state, prefix), endVariable(pb.num_variables() + 1)
+    {
+    }
+
+    size_t numVariables() const
+    {
+        return endVariable - this->firstVariable;
+    }
+};
+
 } // namespace Loopring
 
 #endif
\ No newline at end of file
@@ -20,9 +20,21 @@ class Circuit : public GadgetT
         : GadgetT(pb, annotation_prefix){};
     virtual ~Circuit(){};
     virtual void generateConstraints(unsigned int blockSize) = 0;
+    // Only allocates the variables (in the same order as generateConstraints).
+    // Used when the constraints are loaded from a cache.
+    virtual void generateVariables(unsigned int blockSize) = 0;
     virtual bool generateWitness(const json &input) = 0;
+    virtual bool generateWitness(const Block &block) = 0;
+    // Generates the witness while the block is being decoded. beginWitness needs all block data
+    // except the transactions and the signature, after that the transactions are added in order.
+    // endWitness needs to be called with the complete block data once beginWitness succeeded.
+    virtual bool beginWitness(const Block &block) = 0;
+    virtual bool addTransactionWitness(UniversalTransaction &&transaction) = 0;
+    virtual bool endWitness(const Block &block) = 0;
     virtual unsigned int getBlockType() = 0;
     virtual unsigned int getBlockSize() = 0;
+    // The index of the transaction slot the variable belongs to, -1 if the variable isn't part of a transaction
+    virtual int getTransactionIndex(libsnark::var_index_t variable) = 0;
     virtual void printInfo() = 0;
 
     libsnark::protoboard<FieldT> &getPb()
@@ -7,6 +7,10 @@
 #include "../Utils/Constants.h"
 #include "../Utils/Data.h"
 #include "../Utils/Utils.h"
+#include "../Utils/Profiler.h"
+#include "../Utils/BlockingQueue.h"
+#include "../Utils/WitnessCache.h"
+#include "../Utils/WitnessTasks.h"
 #include "../Gadgets/MatchingGadgets.h"
 #include "../Gadgets/AccountGadgets.h"
 #include "../Gadgets/StorageGadgets.h"
@@ -27,6 +31,15 @@
 #include "utils.hpp"
 #include "gadgets/subadd.hpp"
 
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#ifdef MULTICORE
+#include <omp.h>
+#endif
+
 using namespace ethsnarks;
 
 // Naming conventions:
@@ -149,6 +162,8 @@ class TransactionGadget : public GadgetT
   public:
     const Constants &constants;
 
+    const libsnark::var_index_t firstVariable;
+
     DualVariableGadget type;
     SelectorGadget selector;
 
@@ -156,15 +171,15 @@ class TransactionGadget : public GadgetT
 
     // Process transaction
     NoopCircuit noop;
-    SpotTradeCircuit spotTrade;
-    DepositCircuit deposit;
-    WithdrawCircuit withdraw;
-    AccountUpdateCircuit accountUpdate;
-    TransferCircuit transfer;
-    AmmUpdateCircuit ammUpdate;
-    SignatureVerificationCircuit signatureVerification;
-    NftMintCircuit nftMint;
-    NftDataCircuit nftData;
+    AllocatedCircuit<SpotTradeCircuit> spotTrade;
+    AllocatedCircuit<DepositCircuit> deposit;
+    AllocatedCircuit<WithdrawCircuit> withdraw;
+    AllocatedCircuit<AccountUpdateCircuit> accountUpdate;
+    AllocatedCircuit<TransferCircuit> transfer;
+    AllocatedCircuit<AmmUpdateCircuit> ammUpdate;
+    AllocatedCircuit<SignatureVerificationCircuit> signatureVerification;
+    AllocatedCircuit<NftMintCircuit> nftMint;
+    AllocatedCircuit<NftDataCircuit> nftData;
     SelectTransactionGadget tx;
 
     // General validation
@@ -215,6 +230,8 @@ class TransactionGadget : public GadgetT
 
           constants(_constants),
 
+          firstVariable(pb.num_variables() + 1),
+
           type(pb, NUM_BITS_TX_TYPE, FMT(prefix, ".type")),
           selector(pb, constants, type.packed, (unsigned int)TransactionType::COUNT, FMT(prefix, ".selector")),
 
@@ -437,97 +454,198 @@ class TransactionGadget : public GadgetT
           uTx.witness.balanceUpdateA_P.before,
           uTx.witness.balanceUpdateB_P.before);
 
-        noop.generate_r1cs_witness();
-        spotTrade.generate_r1cs_witness(uTx.spotTrade);
-        deposit.generate_r1cs_witness(uTx.deposit);
-        withdraw.generate_r1cs_witness(uTx.withdraw);
-        accountUpdate.generate_r1cs_witness(uTx.accountUpdate);
-        transfer.generate_r1cs_witness(uTx.transfer);
-        ammUpdate.generate_r1cs_witness(uTx.ammUpdate);
-        signatureVerification.generate_r1cs_witness(uTx.signatureVerification);
-        nftMint.generate_r1cs_witness(uTx.nftMint);
-        nftData.generate_r1cs_witness(uTx.nftData);
+        // The witness is generated as a task graph. The transaction circuits only depend on the
+        // state, everything after them only on the selected transaction outputs and on the
+        // update gadgets that give them their new roots. The root inputs of the update gadgets are
+        // only constrained, so these chains don't depend on each other.
+        WitnessTasks tasks;
+
+        // Process transaction
+        const std::vector<FieldT> stateValues = getStateValues();
+        tasks.run([&]() {
+            generateCircuitWitness(spotTrade, !uTx.spotTrade, stateValues, [&]() {
+                spotTrade.generate_r1cs_witness(uTx.getSpotTrade());
+            });
+        });
+        tasks.run([&]() {
+            generateCircuitWitness(transfer, !uTx.transfer, stateValues, [&]() {
+                transfer.generate_r1cs_witness(uTx.getTransfer());
+            });
+        });
+        tasks.run([&]() {
+            generateCircuitWitness(withdraw, !uTx.withdraw, stateValues, [&]() {
+                withdraw.generate_r1cs_witness(uTx.getWithdraw());
+            });
+        });
+        tasks.run([&]() {
+            generateCircuitWitness(ammUpdate, !uTx.ammUpdate, stateValues, [&]() {
+                ammUpdate.generate_r1cs_witness(uTx.getAmmUpdate());
+            });
+        });
+        tasks.run([&]() {
+            generateCircuitWitness(nftMint, !uTx.nftMint, stateValues, [&]() {
+                nftMint.generate_r1cs_witness(uTx.getNftMint());
+            });
+        });
+        tasks.run([&]() {
+            generateCircuitWitness(accountUpdate, !uTx.accountUpdate, stateValues, [&]() {
+                accountUpdate.generate_r1cs_witness(uTx.getAccountUpdate());
+            });
+        });
+        tasks.run([&]() {
+            noop.generate_r1cs_witness();
+            generateCircuitWitness(deposit, !uTx.deposit, stateValues, [&]() {
+                deposit.generate_r1cs_witness(uTx.getDeposit());
+            });
+            generateCircuitWitness(signatureVerification, !uTx.signatureVerification, stateValues, [&]() {
+                signatureVerification.generate_r1cs_witness(uTx.getSignatureVerification());
+            });
+            generateCircuitWitness(nftData, !uTx.nftData, stateValues, [&]() {
+                nftData.generate_r1cs_witness(uTx.getNftData());
+            });
+        });
+        tasks.wait();
         tx.generate_r1cs_witness();
 
+        // The most expensive tasks first
+        // Check signatures
+        tasks.run([&]() { signatureVerifierA.generate_r1cs_witness(uTx.witness.signatureA); });
+        tasks.run([&]() { signatureVerifierB.generate_r1cs_witness(uTx.witness.signatureB); });
+
+        // Update UserA
+        tasks.run([&]() {
+            updateBalanceB_A.generate_r1cs_witness(uTx.witness.balanceUpdateB_A);
+            updateAccount_A.generate_r1cs_witness(uTx.witness.accountUpdate_A);
+        });
+        // Update UserB
+        tasks.run([&]() {
+            updateBalanceB_B.generate_r1cs_witness(uTx.witness.balanceUpdateB_B);
+            updateAccount_B.generate_r1cs_witness(uTx.witness.accountUpdate_B);
+        });
+        // Update Operator
+        tasks.run([&]() {
+            updateBalanceA_O.generate_r1cs_witness(uTx.witness.balanceUpdateA_O);
+            updateAccount_O.generate_r1cs_witness(uTx.witness.accountUpdate_O);
+        });
+        tasks.run([&]() {
+            updateStorage_A.generate_r1cs_witness(uTx.witness.storageUpdate_A);
+            updateBalanceS_A.generate_r1cs_witness(uTx.witness.balanceUpdateS_A);
+        });
+        tasks.run([&]() {
+            updateStorage_B.generate_r1cs_witness(uTx.witness.storageUpdate_B);
+            updateBalanceS_B.generate_r1cs_witness(uTx.witness.balanceUpdateS_B);
+        });
+        tasks.run([&]() { updateBalanceB_O.generate_r1cs_witness(uTx.witness.balanceUpdateB_O); });
+
+        // Update Protocol pool
+        tasks.run([&]() { updateBalanceB_P.generate_r1cs_witness(uTx.witness.balanceUpdateB_P); });
+        tasks.run([&]() { updateBalanceA_P.generate_r1cs_witness(uTx.witness.balanceUpdateA_P); });
+
         // General validation
         accountA.generate_r1cs_witness();
         accountB.generate_r1cs_witness();
         validateAccountA.generate_r1cs_witness();
         validateAccountB.generate_r1cs_witness();
 
-        // Check signatures
-        signatureVerifierA.generate_r1cs_witness(uTx.witness.signatureA);
-        signatureVerifierB.generate_r1cs_witness(uTx.witness.signatureB);
-
-        // Update UserA
-        updateStorage_A.generate_r1cs_witness(uTx.witness.storageUpdate_A);
-        updateBalanceS_A.generate_r1cs_witness(uTx.witness.balanceUpdateS_A);
-        updateBalanceB_A.generate_r1cs_witness(uTx.witness.balanceUpdateB_A);
-        updateAccount_A.generate_r1cs_witness(uTx.witness.accountUpdate_A);
+        tasks.wait();
+    }
 
-        // Update UserB
-        updateStorage_B.generate_r1cs_witness(uTx.witness.storageUpdate_B);
-        updateBalanceS_B.generate_r1cs_witness(uTx.witness.balanceUpdateS_B);
-        updateBalanceB_B.generate_r1cs_witness(uTx.witness.balanceUpdateB_B);
-        updateAccount_B.generate_r1cs_witness(uTx.witness.accountUpdate_B);
+    // The witnesses of the transaction circuits that only process dummy data
+    static WitnessCache &getDummyWitnessCache()
+    {
+        // 4M field elements, 128MB
+        static WitnessCache cache(1 << 22);
+        return cache;
+    }
 
-        // Update Operator
-        updateBalanceB_O.generate_r1cs_witness(uTx.witness.balanceUpdateB_O);
-        updateBalanceA_O.generate_r1cs_witness(uTx.witness.balanceUpdateA_O);
-        updateAccount_O.generate_r1cs_witness(uTx.witness.accountUpdate_O);
+    // All values a transaction circuit can depend on besides its own transaction data:
+    // the inputs of the transaction state and everything allocated before the circuits
+    std::vector<FieldT> getStateValues() const
+    {
+        std::vector<FieldT> values = {
+          pb.val(state.exchange),
+          pb.val(state.timestamp),
+          pb.val(state.protocolTakerFeeBips),
+          pb.val(state.protocolMakerFeeBips),
+          pb.val(state.numConditionalTransactions)};
+        values.insert(values.end(), pb.values.begin() + firstVariable - 1, pb.values.begin() + noop.firstVariable - 1);
+        return values;
+    }
 
-        // Update Protocol pool
-        updateBalanceB_P.generate_r1cs_witness(uTx.witness.balanceUpdateB_P);
-        updateBalanceA_P.generate_r1cs_witness(uTx.witness.balanceUpdateA_P);
+    // The transaction circuits that don't process the actual transaction use dummy data, which
+    // only depends on the transaction state (see UniversalTransaction). Their witness is the
+    // same for every transaction with the same state (e.g. the noops padding a block), so it
+    // is reused from the cache. All transactions have the same layout, so a circuit is
+    // identified by the position of its variables in the transaction.
+    template <typename CircuitT, typename F>
+    void generateCircuitWitness(
+      const AllocatedCircuit<CircuitT> &circuit,
+      bool dummy,
+      const std::vector<FieldT> &stateValues,
+      const F &generate)
+    {
+        if (!dummy)
+        {
+            generate();
+            return;
+        }
+        WitnessCache &cache = getDummyWitnessCache();
+        const std::string key = WitnessCache::getKey(circuit.firstVariable - firstVariable, stateValues);
+        FieldT *witness = &pb.values[circuit.firstVariable - 1];
+        if (!cache.lookup(key, witness, circuit.numVariables()))
+        {
+            generate();
+            cache.insert(key, witness, circuit.numVariables());
+        }
     }
 
     void generate_r1cs_constraints()
     {
-        type.generate_r1cs_constraints(true);
-        selector.generate_r1cs_constraints();
-
-        noop.generate_r1cs_constraints();
-        spotTrade.generate_r1cs_constraints();
-        deposit.generate_r1cs_constraints();
-        withdraw.generate_r1cs_constraints();
-        accountUpdate.generate_r1cs_constraints();
-        transfer.generate_r1cs_constraints();
-        ammUpdate.generate_r1cs_constraints();
-        signatureVerification.generate_r1cs_constraints();
-        nftMint.generate_r1cs_constraints();
-        nftData.generate_r1cs_constraints();
-        tx.generate_r1cs_constraints();
+        profile_r1cs_constraints(pb, "type", type, true);
+        profile_r1cs_constraints(pb, "selector", selector);
+
+        profile_r1cs_constraints(pb, "noop", noop);
+        profile_r1cs_constraints(pb, "spotTrade", spotTrade);
+        profile_r1cs_constraints(pb, "deposit", deposit);
+        profile_r1cs_constraints(pb, "withdraw", withdraw);
+        profile_r1cs_constraints(pb, "accountUpdate", accountUpdate);
+        profile_r1cs_constraints(pb, "transfer", transfer);
+        profile_r1cs_constraints(pb, "ammUpdate", ammUpdate);
+        profile_r1cs_constraints(pb, "signatureVerification", signatureVerification);
+        profile_r1cs_constraints(pb, "nftMint", nftMint);
+        profile_r1cs_constraints(pb, "nftData", nftData);
+        profile_r1cs_constraints(pb, "tx", tx);
 
         // General validation
-        accountA.generate_r1cs_constraints();
-        accountB.generate_r1cs_constraints();
-        validateAccountA.generate_r1cs_constraints();
-        validateAccountB.generate_r1cs_constraints();
+        profile_r1cs_constraints(pb, "accountA", accountA);
+        profile_r1cs_constraints(pb, "accountB", accountB);
+        profile_r1cs_constraints(pb, "validateAccountA", validateAccountA);
+        profile_r1cs_constraints(pb, "validateAccountB", validateAccountB);
 
         // Check signatures
-        signatureVerifierA.generate_r1cs_constraints();
-        signatureVerifierB.generate_r1cs_constraints();
+        profile_r1cs_constraints(pb, "signatureVerifierA", signatureVerifierA);
+        profile_r1cs_constraints(pb, "signatureVerifierB", signatureVerifierB);
 
         // Update UserA
-        updateStorage_A.generate_r1cs_constraints();
-        updateBalanceS_A.generate_r1cs_constraints();
-        updateBalanceB_A.generate_r1cs_constraints();
-        updateAccount_A.generate_r1cs_constraints();
+        profile_r1cs_constraints(pb, "updateStorage_A", updateStorage_A);
+        profile_r1cs_constraints(pb, "updateBalanceS_A", updateBalanceS_A);
+        profile_r1cs_constraints(pb, "updateBalanceB_A", updateBalanceB_A);
+        profile_r1cs_constraints(pb, "updateAccount_A", updateAccount_A);
 
         // Update UserB
-        updateStorage_B.generate_r1cs_constraints();
-        updateBalanceS_B.generate_r1cs_constraints();
-        updateBalanceB_B.generate_r1cs_constraints();
-        updateAccount_B.generate_r1cs_constraints();
+        profile_r1cs_constraints(pb, "updateStorage_B", updateStorage_B);
+        profile_r1cs_constraints(pb, "updateBalanceS_B", updateBalanceS_B);
+        profile_r1cs_constraints(pb, "updateBalanceB_B", updateBalanceB_B);
+        profile_r1cs_constraints(pb, "updateAccount_B", updateAccount_B);
 
         // Update Operator
-        updateBalanceB_O.generate_r1cs_constraints();
-        updateBalanceA_O.generate_r1cs_constraints();
-        updateAccount_O.generate_r1cs_constraints();
+        profile_r1cs_constraints(pb, "updateBalanceB_O", updateBalanceB_O);
+        profile_r1cs_constraints(pb, "updateBalanceA_O", updateBalanceA_O);
+        profile_r1cs_constraints(pb, "updateAccount_O", updateAccount_O);
 
         // Update Protocol fee pool
-        updateBalanceB_P.generate_r1cs_constraints();
-        updateBalanceA_P.generate_r1cs_constraints();
+        profile_r1cs_constraints(pb, "updateBalanceB_P", updateBalanceB_P);
+        profile_r1cs_constraints(pb, "updateBalanceA_P", updateBalanceA_P);
     }
 
     const VariableArrayT getPublicData() const
@@ -546,6 +664,269 @@ class TransactionGadget : public GadgetT
     }
 };
 
+// The variables of a transaction slot on the circuit protoboard
+struct TransactionSlot
+{
+    // Index on the circuit protoboard of every input of the segment
+    std::vector<libsnark::var_index_t> inputIndices;
+    // Index on the circuit protoboard of the first variable of the slot
+    libsnark::var_index_t offset;
+
+    // Outputs on the circuit protoboard
+    VariableT newAccountsRoot;
+    VariableT newProtocolBalancesRoot;
+    VariableT numConditionalTransactionsAfter;
+    VariableArrayT publicData;
+};
+
+// A transaction built on its own protoboard. The inputs of the transaction are placeholder
+// variables that are mapped to the variables of a slot on the circuit protoboard. All other
+// variables are mapped to a contiguous range on the circuit protoboard, exactly as if the
+// transaction was built on it directly.
+// All slots have the same structure, so a single segment can be used as the template for
+// any number of slots, both for the constraints and for generating the witness.
+class TransactionSegment
+{
+  public:
+    ProtoboardT pb;
+
+    // Inputs
+    Constants constants;
+    const VariableT exchange;
+    const VariableT accountsRoot;
+    const VariableT timestamp;
+    const VariableT protocolTakerFeeBips;
+    const VariableT protocolMakerFeeBips;
+    const VariableArrayT operatorAccountID;
+    const VariableT protocolBalancesRoot;
+    const VariableT numConditionalTransactionsBefore;
+    const size_t numInputs;
+
+    TransactionGadget transaction;
+
+    // The values before any witness was generated
+    std::vector<FieldT> initialValues;
+
+    TransactionSegment(const jubjub::Params &params, bool withConstraints, const std::string &prefix)
+        : constants(pb, FMT(prefix, ".constants")),
+          exchange(make_variable(pb, FMT(prefix, ".exchange"))),
+          accountsRoot(make_variable(pb, FMT(prefix, ".accountsRoot"))),
+          timestamp(make_variable(pb, FMT(prefix, ".timestamp"))),
+          protocolTakerFeeBips(make_variable(pb, FMT(prefix, ".protocolTakerFeeBips"))),
+          protocolMakerFeeBips(make_variable(pb, FMT(prefix, ".protocolMakerFeeBips"))),
+          operatorAccountID(make_var_array(pb, NUM_BITS_ACCOUNT, FMT(prefix, ".operatorAccountID"))),
+          protocolBalancesRoot(make_variable(pb, FMT(prefix, ".protocolBalancesRoot"))),
+          numConditionalTransactionsBefore(make_variable(pb, FMT(prefix, ".numConditionalTransactionsBefore"))),
+          numInputs(pb.num_variables()),
+
+          transaction(
+            pb,
+            params,
+            constants,
+            exchange,
+            accountsRoot,
+            timestamp,
+            protocolTakerFeeBips,
+            protocolMakerFeeBips,
+            operatorAccountID,
+            protocolBalancesRoot,
+            numConditionalTransactionsBefore,
+            prefix)
+    {
+        if (withConstraints)
+        {
+            profile_r1cs_constraints(pb, "transactions", transaction);
+        }
+        initialValues = pb.values;
+    }
+
+    // Maps the inputs to the variables on the circuit protoboard and allocates the variables of a slot.
+    // Needs to be called for all slots in order.
+    TransactionSlot connect(
+      ProtoboardT &circuitPb,
+      const Constants &_constants,
+      const VariableT &_exchange,
+      const VariableT &_accountsRoot,
+      const VariableT &_timestamp,
+      const VariableT &_protocolTakerFeeBips,
+      const VariableT &_protocolMakerFeeBips,
+      const VariableArrayT &_operatorAccountID,
+      const VariableT &_protocolBalancesRoot,
+      const VariableT &_numConditionalTransactionsBefore) const
+    {
+        TransactionSlot slot;
+        slot.inputIndices.assign(numInputs + 1, 0);
+        // The constants are allocated first and in the same order on both protoboards
+        for (libsnark::var_index_t i = constants._0.index; i < exchange.index; i++)
+        {
+            slot.inputIndices[i] = _constants._0.index + (i - constants._0.index);
+        }
+        slot.inputIndices[exchange.index] = _exchange.index;
+        slot.inputIndices[accountsRoot.index] = _accountsRoot.index;
+        slot.inputIndices[timestamp.index] = _timestamp.index;
+        slot.inputIndices[protocolTakerFeeBips.index] = _protocolTakerFeeBips.index;
+        slot.inputIndices[protocolMakerFeeBips.index] = _protocolMakerFeeBips.index;
+        for (size_t i = 0; i < operatorAccountID.size(); i++)
+        {
+            slot.inputIndices[operatorAccountID[i].index] = _operatorAccountID[i].index;
+        }
+        slot.inputIndices[protocolBalancesRoot.index] = _protocolBalancesRoot.index;
+        slot.inputIndices[numConditionalTransactionsBefore.index] = _numConditionalTransactionsBefore.index;
+
+        // Allocate the variables of the slot
+        slot.offset = circuitPb.num_variables() + 1;
+        for (libsnark::var_index_t i = numInputs + 1; i <= pb.num_variables(); i++)
+        {
+#ifdef DEBUG
+            make_variable(circuitPb, pb.constraint_system.variable_annotations[i]);
+#else
+            make_variable(circuitPb, "");
+#endif
+        }
+
+        slot.newAccountsRoot = toCircuit(slot, transaction.getNewAccountsRoot());
+        slot.newProtocolBalancesRoot = toCircuit(slot, transaction.getNewProtocolBalancesRoot());
+        slot.numConditionalTransactionsAfter = toCircuit(slot, transaction.tx.getOutput(TXV_NUM_CONDITIONAL_TXS));
+        slot.publicData = toCircuit(slot, transaction.getPublicData());
+        return slot;
+    }
+
+    // Adds a copy of the constraints of the segment to the slot on the circuit protoboard
+    void addConstraintsTo(ProtoboardT &circuitPb, const TransactionSlot &slot) const
+    {
+        const auto &constraints = pb.constraint_system.constraints;
+        for (size_t i = 0; i < constraints.size(); i++)
+        {
+            libsnark::linear_combination<FieldT> lcs[3];
+            addTerms(slot, lcs[0], constraints[i]->getA());
+            addTerms(slot, lcs[1], constraints[i]->getB());
+            addTerms(slot, lcs[2], constraints[i]->getC());
+#ifdef DEBUG
+            circuitPb.add_r1cs_constraint(
+              ConstraintT(lcs[0], lcs[1], lcs[2]), pb.constraint_system.constraint_annotations[i]);
+#else
+            circuitPb.add_r1cs_constraint(ConstraintT(lcs[0], lcs[1], lcs[2]), "");
+#endif
+        }
+    }
+
+    // The constraints are only needed until they are added to all slots
+    void releaseConstraints()
+    {
+        releaseConstraints(pb.constraint_system.constraints);
+    }
+
+    VariableT toCircuit(const TransactionSlot &slot, const VariableT &variable) const
+    {
+        return VariableT(toCircuit(slot, variable.index));
+    }
+
+    VariableArrayT toCircuit(const TransactionSlot &slot, const VariableArrayT &variables) const
+    {
+        VariableArrayT result;
+        result.reserve(variables.size());
+        for (const VariableT &variable : variables)
+        {
+            result.emplace_back(toCircuit(slot, variable));
+        }
+        return result;
+    }
+
+    // The values of the inputs of the slot on the circuit protoboard
+    std::vector<FieldT> getInputs(const ProtoboardT &circuitPb, const TransactionSlot &slot) const
+    {
+        std::vector<FieldT> inputs(numInputs);
+        for (libsnark::var_index_t i = 1; i <= numInputs; i++)
+        {
+            inputs[i - 1] = circuitPb.val(VariableT(slot.inputIndices[i]));
+        }
+        return inputs;
+    }
+
+    // Same as above, but the inputs that are outputs of the previous slot are taken from the data of
+    // the previous transaction, so the previous slot can still be generating its witness.
+    std::vector<FieldT> getInputs(
+      const ProtoboardT &circuitPb,
+      const TransactionSlot &slot,
+      const UniversalTransaction &previous) const
+    {
+        std::vector<FieldT> inputs(numInputs);
+        for (libsnark::var_index_t i = 1; i <= numInputs; i++)
+        {
+            if (i == accountsRoot.index)
+            {
+                inputs[i - 1] = previous.witness.accountUpdate_O.rootAfter;
+            }
+            else if (i == protocolBalancesRoot.index)
+            {
+                inputs[i - 1] = previous.witness.balanceUpdateA_P.rootAfter;
+            }
+            else if (i == numConditionalTransactionsBefore.index)
+            {
+                inputs[i - 1] = previous.witness.numConditionalTransactionsAfter;
+            }
+            else
+            {
+                inputs[i - 1] = circuitPb.val(VariableT(slot.inputIndices[i]));
+            }
+        }
+        return inputs;
+    }
+
+    // Generates the witness of the slot on the segment and copies the values to the circuit protoboard.
+    // The inputs need to be read beforehand because the slots are processed in parallel.
+    void generate_r1cs_witness(
+      ProtoboardT &circuitPb,
+      const TransactionSlot &slot,
+      const std::vector<FieldT> &inputs,
+      const UniversalTransaction &uTx)
+    {
+        // Start from a clean state, the segment may have been used for another slot
+        std::copy(initialValues.begin(), initialValues.end(), pb.values.begin());
+        std::copy(inputs.begin(), inputs.end(), pb.values.begin());
+        pb.val(transaction.tx.getOutput(TXV_NUM_CONDITIONAL_TXS)) = uTx.witness.numConditionalTransactionsAfter;
+
+        transaction.generate_r1cs_witness(uTx);
+
+        std::copy(pb.values.begin() + numInputs, pb.values.end(), circuitPb.values.begin() + (slot.offset - 1));
+    }
+
+  private:
+    libsnark::var_index_t toCircuit(const TransactionSlot &slot, libsnark::var_index_t index) const
+    {
+        if (index == 0)
+        {
+            return 0;
+        }
+        return (index <= numInputs) ? slot.inputIndices[index] : slot.offset + (index - numInputs - 1);
+    }
+
+    void addTerms(
+      const TransactionSlot &slot,
+      libsnark::linear_combination<FieldT> &lc,
+      const libsnark::linear_combination<FieldT> &other) const
+    {
+        for (const auto &term : other.getTerms())
+        {
+            lc.add_term(libsnark::variable<FieldT>(toCircuit(slot, term.index)), term.getCoeff());
+        }
+    }
+
+    template <typename T> static void releaseConstraints(std::vector<T *> &constraints)
+    {
+        for (T *constraint : constraints)
+        {
+            delete constraint;
+        }
+        std::vector<T *>().swap(constraints);
+    }
+
+    template <typename T> static void releaseConstraints(std::vector<std::unique_ptr<T>> &constraints)
+    {
+        std::vector<std::unique_ptr<T>>().swap(constraints);
+    }
+};
+
 class UniversalCircuit : public Circuit
 {
   public:
@@ -576,7 +957,14 @@ class UniversalCircuit : public Circuit
 
     // Transactions
     unsigned int numTransactions;
-    std::vector<TransactionGadget> transactions;
+    std::vector<TransactionSlot> transactions;
+    // The first variable after the variables of all slots
+    libsnark::var_index_t transactionsEnd = 0;
+    // The constraints of all slots
+    size_t transactionConstraintsBegin = 0;
+    size_t transactionConstraintsEnd = 0;
+    // Either a single segment per slot, or a few segments used as templates for all slots
+    std::vector<std::unique_ptr<TransactionSegment>> segments;
 
     // Update Protocol pool
     std::unique_ptr<UpdateAccountGadget> updateAccount_P;
@@ -584,6 +972,19 @@ class UniversalCircuit : public Circuit
     // Update Operator
     std::unique_ptr<UpdateAccountGadget> updateAccount_O;
 
+    // Streaming witness generation
+    struct TransactionJob
+    {
+        unsigned int index;
+        std::vector<FieldT> inputs;
+        UniversalTransaction transaction;
+    };
+    std::unique_ptr<BlockingQueue<std::shared_ptr<TransactionJob>>> jobs;
+    std::vector<std::thread> workers;
+    std::shared_ptr<TransactionJob> previousJob;
+    unsigned int numStreamedTransactions = 0;
+    unsigned int threadsPerTransaction = 1;
+
     UniversalCircuit( //
       ProtoboardT &pb,
       const std::string &prefix)
@@ -622,52 +1023,140 @@ class UniversalCircuit : public Circuit
     }
 
     void generateConstraints(unsigned int blockSize) override
+    {
+        build(blockSize, true);
+    }
+
+    void generateVariables(unsigned int blockSize) override
+    {
+        build(blockSize, false);
+    }
+
+    // With `templates` the constraints of the transactions are copied from a single segment,
+    // otherwise every slot is built separately (see below)
+    void build(unsigned int blockSize, bool withConstraints, bool templates = true)
     {
         this->numTransactions = blockSize;
 
-        constants.generate_r1cs_constraints();
+        if (withConstraints)
+        {
+            profile_r1cs_constraints(pb, "constants", constants);
+        }
 
         // Inputs
-        exchange.generate_r1cs_constraints(true);
-        merkleRootBefore.generate_r1cs_constraints(true);
-        merkleRootAfter.generate_r1cs_constraints(true);
-        timestamp.generate_r1cs_constraints(true);
-        protocolTakerFeeBips.generate_r1cs_constraints(true);
-        protocolMakerFeeBips.generate_r1cs_constraints(true);
-        operatorAccountID.generate_r1cs_constraints(true);
+        if (withConstraints)
+        {
+            profile_r1cs_constraints(pb, "exchange", exchange, true);
+            profile_r1cs_constraints(pb, "merkleRootBefore", merkleRootBefore, true);
+            profile_r1cs_constraints(pb, "merkleRootAfter", merkleRootAfter, true);
+            profile_r1cs_constraints(pb, "timestamp", timestamp, true);
+            profile_r1cs_constraints(pb, "protocolTakerFeeBips", protocolTakerFeeBips, true);
+            profile_r1cs_constraints(pb, "protocolMakerFeeBips", protocolMakerFeeBips, true);
+            profile_r1cs_constraints(pb, "operatorAccountID", operatorAccountID, true);
+        }
 
         // Increment the nonce of the Operator
-        nonce_after.generate_r1cs_constraints();
+        if (withConstraints)
+        {
+            profile_r1cs_constraints(pb, "nonce_after", nonce_after);
+        }
 
         // Transactions
+        // The transactions are built on their own protoboards and added to the circuit in order,
+        // which results in exactly the same constraint system as building them on the circuit
+        // protoboard directly. The structure of all transactions is the same, so normally only
+        // a few segments are built (one per thread for the witness generation) and their
+        // constraints are copied to all slots.
+        // The profiler can only follow a single protoboard at a time and debug builds keep the
+        // annotations of every slot, so then every slot is built separately.
+        CircuitProfiler *profiler = CircuitProfiler::getActive();
+        templates = templates && (profiler == nullptr);
+#ifdef DEBUG
+        templates = false;
+#endif
+        size_t numSegments = numTransactions;
+        if (templates)
+        {
+            numSegments = 1;
+#ifdef MULTICORE
+            numSegments = std::max(1, std::min<int>(numTransactions, omp_get_max_threads()));
+#endif
+        }
+        segments.resize(numSegments);
+        // Only the constraints of the first segment are used with templates, the other
+        // segments are only used to generate the witness
+        auto buildSegment = [&](size_t j) {
+            segments[j].reset(
+              new TransactionSegment(params, withConstraints && (!templates || j == 0), FMT("tx", "_%zu", j)));
+        };
+        if (!profiler)
+        {
+            // The coefficients of all linear combinations are stored in the constant storage
+            // of libsnark, which is shared by all protoboards and isn't thread safe. The first
+            // segment is built on its own and adds all coefficients a transaction uses. The
+            // other segments have the same structure, so building them in parallel only looks
+            // up existing coefficients, which is checked afterwards.
+            buildSegment(0);
+            const size_t numConstants = libsnark::ConstantStorage<FieldT>::getInstance().constants.size();
+#ifdef MULTICORE
+#pragma omp parallel for schedule(dynamic)
+#endif
+            for (size_t j = 1; j < numSegments; j++)
+            {
+                buildSegment(j);
+            }
+            if (libsnark::ConstantStorage<FieldT>::getInstance().constants.size() != numConstants)
+            {
+                throw std::runtime_error("Constants were added while building the transactions in parallel");
+            }
+        }
+        transactionConstraintsBegin = pb.num_constraints();
+        transactions.clear();
         transactions.reserve(numTransactions);
         for (size_t j = 0; j < numTransactions; j++)
         {
-            std::cout << "------------------- tx: " << j << std::endl;
-            const VariableT txAccountsRoot =
-              (j == 0) ? merkleRootBefore.packed : transactions.back().getNewAccountsRoot();
-            const VariableT &txProtocolBalancesRoot =
-              (j == 0) ? accountBefore_P.balancesRoot : transactions.back().getNewProtocolBalancesRoot();
-            transactions.emplace_back(
+            size_t firstScope = profiler ? profiler->getNumScopes() : 0;
+            size_t numConstraintsBefore = pb.num_constraints();
+            if (!templates && !segments[j])
+            {
+                buildSegment(j);
+            }
+            const TransactionSegment &segment = *segments[templates ? 0 : j];
+            transactions.push_back(segment.connect(
               pb,
-              params,
               constants,
               exchange.packed,
-              txAccountsRoot,
+              (j == 0) ? merkleRootBefore.packed : transactions[j - 1].newAccountsRoot,
               timestamp.packed,
               protocolTakerFeeBips.packed,
               protocolMakerFeeBips.packed,
               operatorAccountID.bits,
-              txProtocolBalancesRoot,
-              (j == 0) ? constants._0 : transactions.back().tx.getOutput(TXV_NUM_CONDITIONAL_TXS),
-              std::string("tx_") + std::to_string(j));
-            transactions.back().generate_r1cs_constraints();
+              (j == 0) ? accountBefore_P.balancesRoot : transactions[j - 1].newProtocolBalancesRoot,
+              (j == 0) ? constants._0 : transactions[j - 1].numConditionalTransactionsAfter));
+            if (withConstraints)
+            {
+                segment.addConstraintsTo(pb, transactions[j]);
+                if (!templates)
+                {
+                    segments[j]->releaseConstraints();
+                }
+            }
+            if (profiler)
+            {
+                profiler->shiftScopes(firstScope, numConstraintsBefore);
+            }
+        }
+        transactionsEnd = pb.num_variables() + 1;
+        transactionConstraintsEnd = pb.num_constraints();
+        for (auto &segment : segments)
+        {
+            segment->releaseConstraints();
         }
 
         // Update Protocol pool
         updateAccount_P.reset(new UpdateAccountGadget(
           pb,
-          transactions.back().getNewAccountsRoot(),
+          transactions.back().newAccountsRoot,
           constants.zeroAccount,
           {accountBefore_P.owner,
            accountBefore_P.publicKey.x,
@@ -680,9 +1169,12 @@ class UniversalCircuit : public Circuit
            accountBefore_P.publicKey.y,
            accountBefore_P.nonce,
            accountBefore_P.feeBipsAMM,
-           transactions.back().getNewProtocolBalancesRoot()},
+           transactions.back().newProtocolBalancesRoot},
           FMT(annotation_prefix, ".updateAccount_P")));
-        updateAccount_P->generate_r1cs_constraints();
+        if (withConstraints)
+        {
+            profile_r1cs_constraints(pb, "updateAccount_P", *updateAccount_P);
+        }
 
         // Update Operator
         updateAccount_O.reset(new UpdateAccountGadget(
@@ -702,12 +1194,18 @@ class UniversalCircuit : public Circuit
            accountBefore_O.feeBipsAMM,
            accountBefore_O.balancesRoot},
           FMT(annotation_prefix, ".updateAccount_O")));
-        updateAccount_O->generate_r1cs_constraints();
+        if (withConstraints)
+        {
+            profile_r1cs_constraints(pb, "updateAccount_O", *updateAccount_O);
+        }
 
         // Num conditional transactions
         numConditionalTransactions.reset(new ToBitsGadget(
-          pb, transactions.back().tx.getOutput(TXV_NUM_CONDITIONAL_TXS), 32, ".numConditionalTransactions"));
-        numConditionalTransactions->generate_r1cs_constraints();
+          pb, transactions.back().numConditionalTransactionsAfter, 32, ".numConditionalTransactions"));
+        if (withConstraints)
+        {
+            profile_r1cs_constraints(pb, "numConditionalTransactions", *numConditionalTransactions);
+        }
 
         // Public data
         publicData.add(exchange.bits);
@@ -721,20 +1219,33 @@ class UniversalCircuit : public Circuit
         unsigned int start = publicData.publicDataBits.size();
         for (size_t j = 0; j < numTransactions; j++)
         {
-            publicData.add(reverse(transactions[j].getPublicData()));
+            publicData.add(reverse(transactions[j].publicData));
         }
         publicData.transform(start, numTransactions, TX_DATA_AVAILABILITY_SIZE * 8);
-        publicData.generate_r1cs_constraints();
+        if (withConstraints)
+        {
+            profile_r1cs_constraints(pb, "publicData", publicData);
+        }
+        else
+        {
+            publicData.generate_r1cs_gadgets();
+        }
 
         // Signature
-        hash.generate_r1cs_constraints();
-        signatureVerifier.generate_r1cs_constraints();
+        if (withConstraints)
+        {
+            profile_r1cs_constraints(pb, "hash", hash);
+            profile_r1cs_constraints(pb, "signatureVerifier", signatureVerifier);
+        }
 
         // Check the new merkle root
-        requireEqual(pb, updateAccount_O->result(), merkleRootAfter.packed, "newMerkleRoot");
+        if (withConstraints)
+        {
+            requireEqual(pb, updateAccount_O->result(), merkleRootAfter.packed, "newMerkleRoot");
+        }
     }
 
-    bool generateWitness(const Block &block)
+    bool generateWitness(const Block &block) override
     {
         if (block.transactions.size() != numTransactions)
         {
@@ -742,6 +1253,138 @@ class UniversalCircuit : public Circuit
             return false;
         }
 
+        generateBlockWitness(block);
+
+        // Transactions
+        // First set numConditionalTransactionsAfter which is a dependency between
+        // transactions and read the inputs of all slots. Once this is done the
+        // transactions can be processed in parallel.
+        std::vector<std::vector<FieldT>> inputs(block.transactions.size());
+        for (unsigned int i = 0; i < block.transactions.size(); i++)
+        {
+            pb.val(transactions[i].numConditionalTransactionsAfter) =
+              block.transactions[i].witness.numConditionalTransactionsAfter;
+        }
+        for (unsigned int i = 0; i < block.transactions.size(); i++)
+        {
+            inputs[i] = segments[0]->getInputs(pb, transactions[i]);
+        }
+        // With a segment per slot every transaction has its own segment,
+        // otherwise every thread uses its own segment. Threads without a transaction
+        // help with the witness tasks of the other transactions.
+        const bool segmentPerSlot = (segments.size() == block.transactions.size());
+#ifdef MULTICORE
+        const int numThreads = segmentPerSlot ? omp_get_max_threads() : int(segments.size());
+#pragma omp parallel for schedule(dynamic) num_threads(numThreads)
+#endif
+        for (unsigned int i = 0; i < block.transactions.size(); i++)
+        {
+            // std::cout << "--------------- tx: " << i << " ( " <<
+            // block.transactions[i].type << " ) " << std::endl;
+#ifdef MULTICORE
+            TransactionSegment &segment = *segments[segmentPerSlot ? i : omp_get_thread_num()];
+#else
+            TransactionSegment &segment = *segments[segmentPerSlot ? i : 0];
+#endif
+            segment.generate_r1cs_witness(pb, transactions[i], inputs[i], block.transactions[i]);
+        }
+
+        return generateBlockWitnessAfterTransactions(block);
+    }
+
+    bool beginWitness(const Block &block) override
+    {
+        generateBlockWitness(block);
+
+        numStreamedTransactions = 0;
+        previousJob.reset();
+        // Every worker uses its own segment (or the segment of the slot). Without workers
+        // the transactions are processed directly. The threads not needed for the workers
+        // are used for the tasks within the transactions.
+        const bool segmentPerSlot = (segments.size() == numTransactions);
+        unsigned int numWorkers = 0;
+        threadsPerTransaction = 1;
+#ifdef MULTICORE
+        const unsigned int numThreads = omp_get_max_threads();
+        numWorkers = segmentPerSlot ? std::min(numThreads, numTransactions) : segments.size();
+        threadsPerTransaction = std::max(1u, numThreads / std::max(1u, numWorkers));
+#endif
+        if (numWorkers > 1)
+        {
+            // Only a few decoded transactions wait for a worker
+            jobs.reset(new BlockingQueue<std::shared_ptr<TransactionJob>>(numWorkers * 2));
+            for (unsigned int w = 0; w < numWorkers; w++)
+            {
+                workers.emplace_back([this, w, segmentPerSlot]() {
+                    std::shared_ptr<TransactionJob> job;
+                    while (jobs->pop(job))
+                    {
+                        generateTransactionWitness(*segments[segmentPerSlot ? job->index : w], *job);
+                    }
+                });
+            }
+        }
+        return true;
+    }
+
+    bool addTransactionWitness(UniversalTransaction &&transaction) override
+    {
+        if (numStreamedTransactions >= numTransactions)
+        {
+            std::cout << "Invalid number of transactions: more than " << numTransactions << std::endl;
+            return false;
+        }
+        std::shared_ptr<TransactionJob> job = std::make_shared<TransactionJob>();
+        job->index = numStreamedTransactions++;
+        job->transaction = std::move(transaction);
+        // The previous slot may still be generating its witness
+        job->inputs = previousJob ? segments[0]->getInputs(pb, transactions[job->index], previousJob->transaction)
+                                  : segments[0]->getInputs(pb, transactions[job->index]);
+        if (jobs)
+        {
+            jobs->push(job);
+        }
+        else
+        {
+            const bool segmentPerSlot = (segments.size() == numTransactions);
+            generateTransactionWitness(*segments[segmentPerSlot ? job->index : 0], *job);
+        }
+        previousJob = job;
+        return true;
+    }
+
+    bool endWitness(const Block &block) override
+    {
+        if (jobs)
+        {
+            jobs->close();
+            for (std::thread &worker : workers)
+            {
+                worker.join();
+            }
+            workers.clear();
+            jobs.reset();
+        }
+        previousJob.reset();
+        if (numStreamedTransactions != numTransactions)
+        {
+            std::cout << "Invalid number of transactions: " << numStreamedTransactions << std::endl;
+            return false;
+        }
+
+        return generateBlockWitnessAfterTransactions(block);
+    }
+
+    void generateTransactionWitness(TransactionSegment &segment, const TransactionJob &job)
+    {
+        WitnessTasks::runParallel(threadsPerTransaction, [&]() {
+            segment.generate_r1cs_witness(pb, transactions[job.index], job.inputs, job.transaction);
+        });
+    }
+
+    // The witness of everything before the transactions
+    void generateBlockWitness(const Block &block)
+    {
         constants.generate_r1cs_witness();
 
         // State
@@ -759,43 +1402,44 @@ class UniversalCircuit : public Circuit
 
         // Increment the nonce of the Operator
         nonce_after.generate_r1cs_witness();
+    }
 
-        // Transactions
-        // First set numConditionalTransactionsAfter which is a dependency between
-        // transactions. Once this is set the transactions can be processed in
-        // parallel.
-        for (unsigned int i = 0; i < block.transactions.size(); i++)
-        {
-            pb.val(transactions[i].tx.getOutput(TXV_NUM_CONDITIONAL_TXS)) =
-              block.transactions[i].witness.numConditionalTransactionsAfter;
-        }
-#ifdef MULTICORE
-#pragma omp parallel for
-#endif
-        for (unsigned int i = 0; i < block.transactions.size(); i++)
-        {
-            // std::cout << "--------------- tx: " << i << " ( " <<
-            // block.transactions[i].type << " ) " << std::endl;
-            transactions[i].generate_r1cs_witness(block.transactions[i]);
-        }
-
-        // Update Protocol pool
-        updateAccount_P->generate_r1cs_witness(block.accountUpdate_P);
-
-        // Update Operator
-        updateAccount_O->generate_r1cs_witness(block.accountUpdate_O);
-
+    // The witness of everything after the transactions
+    bool generateBlockWitnessAfterTransactions(const Block &block)
+    {
         // Num conditional transactions
         numConditionalTransactions->generate_r1cs_witness_from_packed();
 
-        // Public data
-        publicData.generate_r1cs_witness();
-
-        // Signature
-        hash.generate_r1cs_witness();
-        signatureVerifier.generate_r1cs_witness(block.signature);
-
-        return true;
+        unsigned int numThreads = 1;
+#ifdef MULTICORE
+        numThreads = omp_get_max_threads();
+#endif
+        bool valid = true;
+        WitnessTasks::runParallel(numThreads, [&]() {
+            // The account updates don't depend on the public data, so they are done while the
+            // public data is hashed.
+            WitnessTasks tasks;
+            tasks.run([&]() {
+                // Update Protocol pool
+                updateAccount_P->generate_r1cs_witness(block.accountUpdate_P);
+
+                // Update Operator
+                updateAccount_O->generate_r1cs_witness(block.accountUpdate_O);
+            });
+
+            // Public data
+            valid = publicData.generate_r1cs_witness();
+
+            // Signature
+            // The block hash signed by the operator depends on the public input
+            if (valid)
+            {
+                hash.generate_r1cs_witness();
+                signatureVerifier.generate_r1cs_witness(block.signature);
+            }
+            tasks.wait();
+        });
+        return valid;
     }
 
     bool generateWitness(const json &input) override
@@ -813,6 +1457,21 @@ class UniversalCircuit : public Circuit
         return numTransactions;
     }
 
+    int getTransactionIndex(libsnark::var_index_t variable) override
+    {
+        // The slots are allocated one after the other
+        if (transactions.empty() || variable < transactions[0].offset || variable >= transactionsEnd)
+        {
+            return -1;
+        }
+        auto it = std::upper_bound(
+          transactions.begin(),
+          transactions.end(),
+          variable,
+          [](libsnark::var_index_t index, const TransactionSlot &slot) { return index < slot.offset; });
+        return int(it - transactions.begin()) - 1;
+    }
+
     void printInfo() override
     {
         std::cout << pb.num_constraints() << " constraints (" << (pb.num_constraints() / numTransactions) << "/tx)"
@@ -138,12 +138,11 @@ class UpdateAccountGadget : public GadgetT
 
     void generate_r1cs_witness(const AccountUpdate &update)
     {
-        leafBefore.generate_r1cs_witness();
-        leafAfter.generate_r1cs_witness();
+        // The leaves, and both paths level by level, are hashed together
+        HashAccountLeaf::generate_r1cs_witness({&leafBefore, &leafAfter});
 
-        proof.fill_with_field_elements(pb, update.proof.data);
-        proofVerifierBefore.generate_r1cs_witness();
-        rootCalculatorAfter.generate_r1cs_witness();
+        proof.fill_with_field_elements(pb, update.proof.getValues());
+        MerklePathT::generate_r1cs_witness({&proofVerifierBefore, &rootCalculatorAfter});
 
         // ASSERT(pb.val(proofVerifierBefore.m_expected_root) == update.rootBefore,
         // annotation_prefix);
@@ -267,12 +266,11 @@ class UpdateBalanceGadget : public GadgetT
 
     void generate_r1cs_witness(const BalanceUpdate &update)
     {
-        leafBefore.generate_r1cs_witness();
-        leafAfter.generate_r1cs_witness();
+        // The leaves, and both paths level by level, are hashed together
+        HashBalanceLeaf::generate_r1cs_witness({&leafBefore, &leafAfter});
 
-        proof.fill_with_field_elements(pb, update.proof.data);
-        proofVerifierBefore.generate_r1cs_witness();
-        rootCalculatorAfter.generate_r1cs_witness();
+        proof.fill_with_field_elements(pb, update.proof.getValues());
+        MerklePathT::generate_r1cs_witness({&proofVerifierBefore, &rootCalculatorAfter});
 
         // ASSERT(pb.val(proofVerifierBefore.m_expected_root) == update.rootBefore,
         // annotation_prefix);
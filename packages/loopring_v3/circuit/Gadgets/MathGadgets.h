@@ -5,6 +5,8 @@
 
 #include "../Utils/Constants.h"
 #include "../Utils/Data.h"
+#include "../Utils/Poseidon.h"
+#include "../Utils/UInt.h"
 
 #include "ethsnarks.hpp"
 #include "utils.hpp"
@@ -32,6 +34,79 @@ using Poseidon_10 = Poseidon_gadget_T<11, 1, 6, 53, 10, 1>;
 using Poseidon_11 = Poseidon_gadget_T<12, 1, 6, 53, 11, 1>;
 using Poseidon_12 = Poseidon_gadget_T<13, 1, 6, 53, 12, 1>;
 
+// A hash gadget whose witness is computed with the native Poseidon permutation (NativeT has
+// the same parameters as HashT). All variables of the hash gadget are allocated when it is
+// created, so its witness is a range of variables, which the native permutation writes
+// directly (in the layout described by NativeT::NUM_VARIABLES).
+template <typename HashT, typename NativeT> class NativeHashGadget : public GadgetT
+{
+  public:
+    const VariableArrayT inputs;
+    const libsnark::var_index_t firstVariable;
+    HashT hash;
+    const size_t numVariables;
+
+    NativeHashGadget(ProtoboardT &pb, const VariableArrayT &_inputs, const std::string &prefix)
+        : GadgetT(pb, prefix),
+          inputs(_inputs),
+          firstVariable(pb.num_variables() + 1),
+          hash(pb, inputs, prefix),
+          numVariables(pb.num_variables() + 1 - firstVariable)
+    {
+        if (numVariables != NativeT::NUM_VARIABLES)
+        {
+            throw std::runtime_error(
+              "Unexpected number of hash variables: " + std::to_string(numVariables) + " (expected " +
+              std::to_string(NativeT::NUM_VARIABLES) + ")");
+        }
+    }
+
+    void generate_r1cs_constraints()
+    {
+        hash.generate_r1cs_constraints();
+    }
+
+    void generate_r1cs_witness()
+    {
+        generate_r1cs_witness({this});
+    }
+
+    // Generates the witness of all gadgets together, so their permutations are batched
+    static void generate_r1cs_witness(const std::vector<NativeHashGadget *> &gadgets)
+    {
+        std::vector<typename NativeT::State> states(gadgets.size());
+        std::vector<FieldT *> witnesses(gadgets.size());
+        for (size_t i = 0; i < gadgets.size(); i++)
+        {
+            states[i] = gadgets[i]->getState();
+            witnesses[i] = gadgets[i]->getWitness();
+        }
+        NativeT::permute(states.data(), states.size(), witnesses.data());
+    }
+
+    const VariableT &result() const
+    {
+        return hash.result();
+    }
+
+    // The values of the variables of the hash gadget
+    FieldT *getWitness() const
+    {
+        return &pb.values[firstVariable - 1];
+    }
+
+  private:
+    typename NativeT::State getState() const
+    {
+        typename NativeT::State state;
+        for (size_t i = 0; i < state.size(); i++)
+        {
+            state[i] = (i < inputs.size()) ? pb.val(inputs[i]) : FieldT::zero();
+        }
+        return state;
+    }
+};
+
 // require(A == B)
 static void requireEqual( //
   ProtoboardT &pb,
@@ -1465,8 +1540,7 @@ class MulDivGadget : public GadgetT
         product.generate_r1cs_witness();
         if (pb.val(denominator) != FieldT::zero())
         {
-            pb.val(quotient) = ethsnarks::FieldT(
-              (toBigInt(pb.val(product.result())) / toBigInt(pb.val(denominator))).to_string().c_str());
+            pb.val(quotient) = (UInt256(pb.val(product.result())) / UInt256(pb.val(denominator))).toField();
         }
         else
         {
@@ -1639,8 +1713,19 @@ class PublicDataGadget : public GadgetT
         publicDataBits = transformedBits;
     }
 
-    void generate_r1cs_witness()
+    // Returns false if the public data isn't valid, which would make the hash meaningless
+    bool generate_r1cs_witness()
     {
+        for (size_t i = 0; i < publicDataBits.size(); i++)
+        {
+            const FieldT &bit = pb.val(publicDataBits[i]);
+            if (bit != FieldT::zero() && bit != FieldT::one())
+            {
+                std::cout << "Invalid public data bit: " << i << std::endl;
+                return false;
+            }
+        }
+
         // Calculate the hash
         hasher->generate_r1cs_witness();
 
@@ -1651,17 +1736,25 @@ class PublicDataGadget : public GadgetT
         printBits("[ZKS]publicData: 0x", publicDataBits.get_bits(pb), false);
         printBits("[ZKS]publicDataHash: 0x", hasher->result().bits.get_bits(pb));
         print(pb, "[ZKS]publicInput", calculatedHash->packed);
+        return true;
+    }
+
+    // Creates the hash gadgets, can only be done once all data is added
+    void generate_r1cs_gadgets()
+    {
+        hasher.reset(new sha256_many(pb, publicDataBits, ".hasher"));
+        calculatedHash.reset(new FromBitsGadget(
+          pb, reverse(subArray(hasher->result().bits, 0, NUM_BITS_FIELD_CAPACITY)), ".packCalculatedHash"));
     }
 
     void generate_r1cs_constraints()
     {
+        generate_r1cs_gadgets();
+
         // Calculate the hash
-        hasher.reset(new sha256_many(pb, publicDataBits, ".hasher"));
         hasher->generate_r1cs_constraints();
 
         // Check that the hash matches the public input
-        calculatedHash.reset(new FromBitsGadget(
-          pb, reverse(subArray(hasher->result().bits, 0, NUM_BITS_FIELD_CAPACITY)), ".packCalculatedHash"));
         calculatedHash->generate_r1cs_constraints(false);
         requireEqual(pb, calculatedHash->packed, publicInput, ".publicDataCheck");
     }
@@ -1747,13 +1840,13 @@ class FloatGadget : public GadgetT
             {
                 pb.add_r1cs_constraint(
                   ConstraintT(f[j], FieldT::one(), values[i]),
-                  FMT(annotation_prefix, (std::string(".value_") + std::to_string(i)).c_str()));
+                  FMT(annotation_prefix, ".value_%u", i));
             }
             else
             {
                 pb.add_r1cs_constraint(
                   ConstraintT(values[i - 1] * 2 + f[j], FieldT::one(), values[i]),
-                  FMT(annotation_prefix, (std::string(".value_") + std::to_string(i)).c_str()));
+                  FMT(annotation_prefix, ".value_%u", i));
             }
         }
 
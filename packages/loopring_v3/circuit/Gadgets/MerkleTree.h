@@ -6,10 +6,54 @@
 #include "ethsnarks.hpp"
 #include "gadgets/poseidon.hpp"
 #include "MathGadgets.h"
+#include "../Utils/WitnessCache.h"
+
+#include <string>
+#include <typeinfo>
+#include <vector>
 
 namespace Loopring
 {
 
+// A hash gadget that takes its witness from the witness cache when the same inputs were
+// hashed before (e.g. the hashes of empty subtrees, or the paths of the accounts used in
+// every transaction). The other hashes are computed natively.
+template <typename HashT, typename NativeT> class CachedHashGadget : public NativeHashGadget<HashT, NativeT>
+{
+  public:
+    CachedHashGadget(ProtoboardT &pb, const VariableArrayT &_inputs, const std::string &prefix)
+        : NativeHashGadget<HashT, NativeT>(pb, _inputs, prefix)
+    {
+    }
+
+    void generate_r1cs_witness()
+    {
+        generate_r1cs_witness({this});
+    }
+
+    // Generates the witness of all gadgets together, the hashes not in the cache are batched
+    static void generate_r1cs_witness(const std::vector<CachedHashGadget *> &gadgets)
+    {
+        WitnessCache &cache = WitnessCache::getInstance();
+        std::vector<NativeHashGadget<HashT, NativeT> *> misses;
+        std::vector<std::string> keys;
+        for (CachedHashGadget *gadget : gadgets)
+        {
+            std::string key = WitnessCache::getKey(typeid(HashT).hash_code(), gadget->inputs.get_vals(gadget->pb));
+            if (!cache.lookup(key, gadget->getWitness(), gadget->numVariables))
+            {
+                misses.push_back(gadget);
+                keys.push_back(std::move(key));
+            }
+        }
+        NativeHashGadget<HashT, NativeT>::generate_r1cs_witness(misses);
+        for (size_t i = 0; i < misses.size(); i++)
+        {
+            cache.insert(keys[i], misses[i]->getWitness(), misses[i]->numVariables);
+        }
+    }
+};
+
 class merkle_path_selector_4 : public GadgetT
 {
   public:
@@ -150,10 +194,23 @@ template <typename HashT> class merkle_path_compute_4 : public GadgetT
 
     void generate_r1cs_witness()
     {
-        for (size_t i = 0; i < m_hashers.size(); i++)
+        generate_r1cs_witness({this});
+    }
+
+    // Generates the witness of paths of the same depth together, one level at a time, so the
+    // hashes of a level are computed together
+    static void generate_r1cs_witness(const std::vector<merkle_path_compute_4 *> &paths)
+    {
+        std::vector<HashT *> hashers(paths.size());
+        for (size_t i = 0; i < paths[0]->m_hashers.size(); i++)
         {
-            m_selectors[i].generate_r1cs_witness();
-            m_hashers[i].generate_r1cs_witness();
+            for (size_t p = 0; p < paths.size(); p++)
+            {
+                assert(paths[p]->m_hashers.size() == paths[0]->m_hashers.size());
+                paths[p]->m_selectors[i].generate_r1cs_witness();
+                hashers[p] = &paths[p]->m_hashers[i];
+            }
+            HashT::generate_r1cs_witness(hashers);
         }
     }
 };
@@ -206,10 +263,10 @@ template <typename HashT> class merkle_path_authenticator_4 : public merkle_path
 };
 
 // Same parameters for ease of implementation in EVM
-using HashMerkleTree = Poseidon_4;
-using HashAccountLeaf = Poseidon_6;
-using HashBalanceLeaf = Poseidon_4_<3>;
-using HashStorageLeaf = Poseidon_4_<2>;
+using HashMerkleTree = CachedHashGadget<Poseidon_4, NativePoseidon_4>;
+using HashAccountLeaf = CachedHashGadget<Poseidon_6, NativePoseidon_6>;
+using HashBalanceLeaf = CachedHashGadget<Poseidon_4_<3>, NativePoseidon_4>;
+using HashStorageLeaf = CachedHashGadget<Poseidon_4_<2>, NativePoseidon_4>;
 
 using MerklePathCheckT = merkle_path_authenticator_4<HashMerkleTree>;
 using MerklePathT = merkle_path_compute_4<HashMerkleTree>;
@@ -4,6 +4,8 @@
 #define _SIGNATUREGADGETS_H_
 
 #include "../Utils/Constants.h"
+#include "../Utils/WitnessCache.h"
+#include "../Utils/WitnessTasks.h"
 
 #include "ethsnarks.hpp"
 #include "utils.hpp"
@@ -189,7 +191,7 @@ class CompressPublicKey : public GadgetT
 class EdDSA_HashRAM_Poseidon_gadget : public GadgetT
 {
   public:
-    Poseidon_5 m_hash_RAM;
+    NativeHashGadget<Poseidon_5, NativePoseidon_5> m_hash_RAM;
     ToBitsGadget hash;
 
     EdDSA_HashRAM_Poseidon_gadget(
@@ -301,11 +303,17 @@ class EdDSA_Poseidon : public GadgetT
 
     void generate_r1cs_witness()
     {
+        // Only hash_RAM is computed natively. The point witnesses (fixed_base_mul, ScalarMult and
+        // the point additions) come from the ethsnarks gadgets: a native Jubjub engine would have
+        // to reproduce their internal variable layouts, which are not part of their interface.
+        // B*s only depends on s, so it is done next to the path of A*hash_RAM
+        WitnessTasks tasks;
+        tasks.run([&]() { m_lhs.generate_r1cs_witness(); });
         m_validator_R.generate_r1cs_witness();
-        m_lhs.generate_r1cs_witness();
         m_hash_RAM.generate_r1cs_witness();
         m_At.generate_r1cs_witness();
         m_rhs.generate_r1cs_witness();
+        tasks.wait();
 
         // Verify the two points are equal
         equalX.generate_r1cs_witness();
@@ -324,9 +332,14 @@ class SignatureVerifier : public GadgetT
 {
   public:
     const Constants &constants;
+    const jubjub::VariablePointT publicKey;
+    const VariableT message;
+    const VariableT required;
     const jubjub::VariablePointT sig_R;
     const VariableArrayT sig_s;
+    const libsnark::var_index_t firstVariable;
     EdDSA_Poseidon signatureVerifier;
+    const size_t numVariables;
 
     IfThenRequireGadget valid;
 
@@ -337,15 +350,19 @@ class SignatureVerifier : public GadgetT
       ProtoboardT &pb,
       const jubjub::Params &params,
       const Constants &_constants,
-      const jubjub::VariablePointT &publicKey,
-      const VariableT &message,
-      const VariableT &required,
+      const jubjub::VariablePointT &_publicKey,
+      const VariableT &_message,
+      const VariableT &_required,
       const std::string &prefix)
         : GadgetT(pb, prefix),
 
           constants(_constants),
+          publicKey(_publicKey),
+          message(_message),
+          required(_required),
           sig_R(pb, FMT(prefix, ".R")),
           sig_s(make_var_array(pb, FieldT::size_in_bits(), FMT(prefix, ".s"))),
+          firstVariable(pb.num_variables() + 1),
           signatureVerifier(
             pb,
             params,
@@ -355,6 +372,7 @@ class SignatureVerifier : public GadgetT
             sig_s,
             message,
             FMT(prefix, ".signatureVerifier")),
+          numVariables(pb.num_variables() + 1 - firstVariable),
           valid(pb, required, signatureVerifier.result(), FMT(prefix, ".valid"))
     {
     }
@@ -364,10 +382,35 @@ class SignatureVerifier : public GadgetT
         pb.val(sig_R.x) = sig.R.x;
         pb.val(sig_R.y) = sig.R.y;
         sig_s.fill_with_bits_of_field_element(pb, sig.s);
-        signatureVerifier.generate_r1cs_witness();
+        // Signatures that aren't required are mostly the same dummy signature for the same
+        // public key and message (e.g. in noops), so their witness is reused
+        if (pb.val(required) == FieldT::zero())
+        {
+            WitnessCache &cache = getWitnessCache();
+            const std::string key = WitnessCache::getKey(
+              typeid(EdDSA_Poseidon).hash_code(),
+              {pb.val(publicKey.x), pb.val(publicKey.y), pb.val(message), sig.R.x, sig.R.y, sig.s});
+            FieldT *witness = &pb.values[firstVariable - 1];
+            if (!cache.lookup(key, witness, numVariables))
+            {
+                signatureVerifier.generate_r1cs_witness();
+                cache.insert(key, witness, numVariables);
+            }
+        }
+        else
+        {
+            signatureVerifier.generate_r1cs_witness();
+        }
         valid.generate_r1cs_witness();
     }
 
+    static WitnessCache &getWitnessCache()
+    {
+        // 1M field elements, 32MB
+        static WitnessCache cache(1 << 20);
+        return cache;
+    }
+
     void generate_r1cs_constraints()
     {
         for (unsigned int i = 0; i < sig_s.size(); i++)
@@ -94,12 +94,11 @@ class UpdateStorageGadget : public GadgetT
 
     void generate_r1cs_witness(const StorageUpdate &update)
     {
-        leafBefore.generate_r1cs_witness();
-        leafAfter.generate_r1cs_witness();
+        // The leaves, and both paths level by level, are hashed together
+        HashStorageLeaf::generate_r1cs_witness({&leafBefore, &leafAfter});
 
-        proof.fill_with_field_elements(pb, update.proof.data);
-        proofVerifierBefore.generate_r1cs_witness();
-        rootCalculatorAfter.generate_r1cs_witness();
+        proof.fill_with_field_elements(pb, update.proof.getValues());
+        MerklePathT::generate_r1cs_witness({&proofVerifierBefore, &rootCalculatorAfter});
 
         ASSERT(pb.val(proofVerifierBefore.m_expected_root) == update.rootBefore, annotation_prefix);
         if (pb.val(rootCalculatorAfter.result()) != update.rootAfter)
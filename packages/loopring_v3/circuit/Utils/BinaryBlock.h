@@ -0,0 +1,652 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2017 Loopring Technology Limited.
+#ifndef _BINARYBLOCK_H_
+#define _BINARYBLOCK_H_
+
+#include "Data.h"
+
+#include "ethsnarks.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace ethsnarks;
+
+namespace Loopring
+{
+
+// Compact binary encoding of a Block, so blocks can be loaded without parsing json
+// and converting decimal strings.
+//
+// Layout (everything little-endian):
+// - magic (8 bytes), version (4 bytes), field element size (4 bytes)
+// - blockType (4 bytes), blockSize (4 bytes)
+// - the members of the Block in declaration order. Field elements are stored in standard
+//   (non-Montgomery) form using the fixed field element size, lists are prefixed with
+//   their length (4 bytes), optional values with a flag (4 bytes, 0 or 1).
+//   Only the data of the actual transaction type is stored for every transaction.
+//   Proof values are only stored once per block: proofs are lists of indices (4 bytes each)
+//   in the table of all proof values of the block, a value is stored right after its index
+//   when it is used for the first time.
+class BinaryBlock
+{
+  public:
+    static const uint64_t MAGIC = 0x4b434f4c4243524cULL; // "LRCBLOCK"
+    static const uint32_t VERSION = 4;
+    static const uint32_t HEADER_SIZE = 24;
+
+    class Writer
+    {
+      public:
+        std::string data;
+        ProofTable proofTable;
+
+        void u32(uint32_t value)
+        {
+            for (unsigned int i = 0; i < 4; i++)
+            {
+                data.push_back(char((value >> (8 * i)) & 0xff));
+            }
+        }
+
+        void u64(uint64_t value)
+        {
+            for (unsigned int i = 0; i < 8; i++)
+            {
+                data.push_back(char((value >> (8 * i)) & 0xff));
+            }
+        }
+
+        void operator()(FieldT &value)
+        {
+            const auto bigint = value.as_bigint();
+            for (unsigned int i = 0; i < FieldT::num_limbs; i++)
+            {
+                u64(bigint.data[i]);
+            }
+        }
+
+        void operator()(jubjub::EdwardsPoint &point)
+        {
+            (*this)(point.x);
+            (*this)(point.y);
+        }
+
+        template <typename T> void operator()(std::vector<T> &values)
+        {
+            u32(values.size());
+            for (T &value : values)
+            {
+                (*this)(value);
+            }
+        }
+
+        void operator()(Proof &proof)
+        {
+            u32(proof.size());
+            for (unsigned int i = 0; i < proof.size(); i++)
+            {
+                const size_t numValues = proofTable.size();
+                const uint32_t index = proofTable.intern(proof[i]);
+                u32(index);
+                if (index == numValues)
+                {
+                    FieldT value = proof[i];
+                    (*this)(value);
+                }
+            }
+        }
+
+        template <typename T> void operator()(std::shared_ptr<const T> &value)
+        {
+            u32(value ? 1 : 0);
+            if (value)
+            {
+                (*this)(const_cast<T &>(*value));
+            }
+        }
+
+        template <typename T> void operator()(T &value)
+        {
+            serialize(*this, value);
+        }
+    };
+
+    class Reader
+    {
+      public:
+        Reader(const char *_data, size_t _size)
+            : data((const uint8_t *)_data),
+              size(_size),
+              offset(0),
+              ok(true),
+              proofValues(std::make_shared<std::deque<FieldT>>())
+        {
+        }
+
+        uint32_t u32()
+        {
+            return uint32_t(readBytes(4));
+        }
+
+        uint64_t u64()
+        {
+            return readBytes(8);
+        }
+
+        void operator()(FieldT &value)
+        {
+            libff::bigint<FieldT::num_limbs> bigint;
+            for (unsigned int i = 0; i < FieldT::num_limbs; i++)
+            {
+                bigint.data[i] = u64();
+            }
+            value = FieldT(bigint);
+            // Values outside of the field don't round trip
+            if (memcmp(value.as_bigint().data, bigint.data, sizeof(bigint.data)) != 0)
+            {
+                fail("field element out of range");
+            }
+        }
+
+        void operator()(jubjub::EdwardsPoint &point)
+        {
+            (*this)(point.x);
+            (*this)(point.y);
+        }
+
+        template <typename T> void operator()(std::vector<T> &values)
+        {
+            uint32_t length = u32();
+            // Every element takes at least a field element
+            if (length > (size - offset) / (FieldT::num_limbs * 8))
+            {
+                fail("invalid list length");
+                return;
+            }
+            values.resize(length);
+            for (T &value : values)
+            {
+                (*this)(value);
+            }
+        }
+
+        void operator()(Proof &proof)
+        {
+            uint32_t length = u32();
+            if (length > (size - offset) / 4)
+            {
+                fail("invalid list length");
+                return;
+            }
+            proof.table = proofValues;
+            proof.values.resize(length);
+            for (const FieldT *&value : proof.values)
+            {
+                uint32_t index = u32();
+                if (index == proofValues->size())
+                {
+                    FieldT newValue;
+                    (*this)(newValue);
+                    proofValues->push_back(newValue);
+                }
+                else if (index > proofValues->size())
+                {
+                    fail("invalid proof value index");
+                    return;
+                }
+                value = &(*proofValues)[index];
+            }
+        }
+
+        template <typename T> void operator()(std::shared_ptr<const T> &value)
+        {
+            uint32_t present = u32();
+            if (present > 1)
+            {
+                fail("invalid optional value");
+                return;
+            }
+            value.reset();
+            if (present)
+            {
+                std::shared_ptr<T> object = std::make_shared<T>();
+                (*this)(*object);
+                value = object;
+            }
+        }
+
+        template <typename T> void operator()(T &value)
+        {
+            serialize(*this, value);
+        }
+
+        bool isOK() const
+        {
+            return ok;
+        }
+
+        const std::string &getError() const
+        {
+            return error;
+        }
+
+        bool isFinished() const
+        {
+            return offset == size;
+        }
+
+        void fail(const std::string &_error)
+        {
+            if (ok)
+            {
+                ok = false;
+                error = _error + " at offset " + std::to_string(offset);
+            }
+            offset = size;
+        }
+
+      private:
+        const uint8_t *data;
+        size_t size;
+        size_t offset;
+        bool ok;
+        std::string error;
+        // The values of all proofs of the block
+        std::shared_ptr<std::deque<FieldT>> proofValues;
+
+        uint64_t readBytes(unsigned int numBytes)
+        {
+            if (size - offset < numBytes)
+            {
+                fail("unexpected end of data");
+                return 0;
+            }
+            uint64_t value = 0;
+            for (unsigned int i = 0; i < numBytes; i++)
+            {
+                value |= uint64_t(data[offset + i]) << (8 * i);
+            }
+            offset += numBytes;
+            return value;
+        }
+    };
+
+    // Returns true if the data starts with the binary block header
+    static bool isBinary(const char *data, size_t size)
+    {
+        if (size < HEADER_SIZE)
+        {
+            return false;
+        }
+        Reader reader(data, size);
+        return reader.u64() == MAGIC;
+    }
+
+    static std::string encode(unsigned int blockType, unsigned int blockSize, const Block &block)
+    {
+        Writer writer;
+        writer.u64(MAGIC);
+        writer.u32(VERSION);
+        writer.u32(FieldT::num_limbs * 8);
+        writer.u32(blockType);
+        writer.u32(blockSize);
+        // The writer doesn't modify the block
+        writer(const_cast<Block &>(block));
+        return writer.data;
+    }
+
+    static bool decode(
+      const char *data,
+      size_t size,
+      unsigned int &blockType,
+      unsigned int &blockSize,
+      Block &block,
+      std::string &error)
+    {
+        Reader reader(data, size);
+        if (reader.u64() != MAGIC)
+        {
+            error = "Not a binary block";
+            return false;
+        }
+        uint32_t version = reader.u32();
+        uint32_t fieldSize = reader.u32();
+        if (version != VERSION || fieldSize != FieldT::num_limbs * 8)
+        {
+            error = "Unsupported binary block version " + std::to_string(version) + " (field size " +
+                    std::to_string(fieldSize) + ")";
+            return false;
+        }
+        blockType = reader.u32();
+        blockSize = reader.u32();
+        reader(block);
+        if (reader.isOK() && !reader.isFinished())
+        {
+            reader.fail("unexpected data");
+        }
+        if (!reader.isOK())
+        {
+            error = "Invalid binary block: " + reader.getError();
+            return false;
+        }
+        return true;
+    }
+
+    static bool write(const std::string &filename, unsigned int blockType, unsigned int blockSize, const Block &block)
+    {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        std::string data = encode(blockType, blockSize, block);
+        file.write(data.data(), data.size());
+        return file.good();
+    }
+
+    // Decodes the block directly from the mapped file
+    static bool load(
+      const std::string &filename,
+      unsigned int &blockType,
+      unsigned int &blockSize,
+      Block &block,
+      std::string &error)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            error = "Cannot open block file: " + filename;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close(fd);
+            error = "Cannot read block file: " + filename;
+            return false;
+        }
+        void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED)
+        {
+            error = "Cannot map block file: " + filename;
+            return false;
+        }
+        madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+        bool result = decode((const char *)ptr, st.st_size, blockType, blockSize, block, error);
+        munmap(ptr, st.st_size);
+        return result;
+    }
+
+    // Returns true if the file starts with the binary block header
+    static bool isBinaryFile(const std::string &filename)
+    {
+        char header[HEADER_SIZE];
+        std::ifstream file(filename, std::ios::binary);
+        return file.read(header, HEADER_SIZE) && isBinary(header, HEADER_SIZE);
+    }
+};
+
+template <typename Archive> void serialize(Archive &archive, StorageLeaf &leaf)
+{
+    archive(leaf.data);
+    archive(leaf.storageID);
+}
+
+template <typename Archive> void serialize(Archive &archive, BalanceLeaf &leaf)
+{
+    archive(leaf.balance);
+    archive(leaf.weightAMM);
+    archive(leaf.storageRoot);
+}
+
+template <typename Archive> void serialize(Archive &archive, AccountLeaf &account)
+{
+    archive(account.owner);
+    archive(account.publicKey);
+    archive(account.nonce);
+    archive(account.feeBipsAMM);
+    archive(account.balancesRoot);
+}
+
+template <typename Archive> void serialize(Archive &archive, BalanceUpdate &balanceUpdate)
+{
+    archive(balanceUpdate.tokenID);
+    archive(balanceUpdate.proof);
+    archive(balanceUpdate.rootBefore);
+    archive(balanceUpdate.rootAfter);
+    archive(balanceUpdate.before);
+    archive(balanceUpdate.after);
+}
+
+template <typename Archive> void serialize(Archive &archive, StorageUpdate &storageUpdate)
+{
+    archive(storageUpdate.storageID);
+    archive(storageUpdate.proof);
+    archive(storageUpdate.rootBefore);
+    archive(storageUpdate.rootAfter);
+    archive(storageUpdate.before);
+    archive(storageUpdate.after);
+}
+
+template <typename Archive> void serialize(Archive &archive, AccountUpdate &accountUpdate)
+{
+    archive(accountUpdate.accountID);
+    archive(accountUpdate.proof);
+    archive(accountUpdate.rootBefore);
+    archive(accountUpdate.rootAfter);
+    archive(accountUpdate.before);
+    archive(accountUpdate.after);
+}
+
+template <typename Archive> void serialize(Archive &archive, Signature &signature)
+{
+    archive(signature.R);
+    archive(signature.s);
+}
+
+template <typename Archive> void serialize(Archive &archive, Order &order)
+{
+    archive(order.storageID);
+    archive(order.accountID);
+    archive(order.tokenS);
+    archive(order.tokenB);
+    archive(order.amountS);
+    archive(order.amountB);
+    archive(order.validUntil);
+    archive(order.maxFeeBips);
+    archive(order.fillAmountBorS);
+    archive(order.taker);
+    archive(order.nftDataB);
+    archive(order.feeBips);
+    archive(order.amm);
+}
+
+template <typename Archive> void serialize(Archive &archive, SpotTrade &spotTrade)
+{
+    archive(spotTrade.orderA);
+    archive(spotTrade.orderB);
+    archive(spotTrade.fillS_A);
+    archive(spotTrade.fillS_B);
+}
+
+template <typename Archive> void serialize(Archive &archive, Deposit &deposit)
+{
+    archive(deposit.owner);
+    archive(deposit.accountID);
+    archive(deposit.tokenID);
+    archive(deposit.amount);
+}
+
+template <typename Archive> void serialize(Archive &archive, Withdrawal &withdrawal)
+{
+    archive(withdrawal.accountID);
+    archive(withdrawal.tokenID);
+    archive(withdrawal.amount);
+    archive(withdrawal.feeTokenID);
+    archive(withdrawal.fee);
+    archive(withdrawal.onchainDataHash);
+    archive(withdrawal.storageID);
+    archive(withdrawal.validUntil);
+    archive(withdrawal.maxFee);
+    archive(withdrawal.type);
+}
+
+template <typename Archive> void serialize(Archive &archive, AccountUpdateTx &update)
+{
+    archive(update.owner);
+    archive(update.accountID);
+    archive(update.publicKeyX);
+    archive(update.publicKeyY);
+    archive(update.feeTokenID);
+    archive(update.fee);
+    archive(update.maxFee);
+    archive(update.validUntil);
+    archive(update.type);
+}
+
+template <typename Archive> void serialize(Archive &archive, AmmUpdate &update)
+{
+    archive(update.accountID);
+    archive(update.tokenID);
+    archive(update.feeBips);
+    archive(update.tokenWeight);
+}
+
+template <typename Archive> void serialize(Archive &archive, SignatureVerification &verification)
+{
+    archive(verification.accountID);
+    archive(verification.data);
+}
+
+template <typename Archive> void serialize(Archive &archive, Transfer &transfer)
+{
+    archive(transfer.fromAccountID);
+    archive(transfer.toAccountID);
+    archive(transfer.tokenID);
+    archive(transfer.amount);
+    archive(transfer.feeTokenID);
+    archive(transfer.fee);
+    archive(transfer.validUntil);
+    archive(transfer.to);
+    archive(transfer.dualAuthorX);
+    archive(transfer.dualAuthorY);
+    archive(transfer.storageID);
+    archive(transfer.payerToAccountID);
+    archive(transfer.payerTo);
+    archive(transfer.payeeToAccountID);
+    archive(transfer.maxFee);
+    archive(transfer.putAddressesInDA);
+    archive(transfer.type);
+    archive(transfer.toTokenID);
+}
+
+template <typename Archive> void serialize(Archive &archive, NftMint &nftMint)
+{
+    archive(nftMint.minterAccountID);
+    archive(nftMint.tokenAccountID);
+    archive(nftMint.amount);
+    archive(nftMint.feeTokenID);
+    archive(nftMint.fee);
+    archive(nftMint.validUntil);
+    archive(nftMint.maxFee);
+    archive(nftMint.type);
+    archive(nftMint.nftType);
+    archive(nftMint.tokenAddress);
+    archive(nftMint.nftIDHi);
+    archive(nftMint.nftIDLo);
+    archive(nftMint.creatorFeeBips);
+    archive(nftMint.toAccountID);
+    archive(nftMint.toTokenID);
+    archive(nftMint.to);
+    archive(nftMint.storageID);
+}
+
+template <typename Archive> void serialize(Archive &archive, NftData &nftData)
+{
+    archive(nftData.type);
+    archive(nftData.accountID);
+    archive(nftData.tokenID);
+    archive(nftData.minter);
+    archive(nftData.nftType);
+    archive(nftData.tokenAddress);
+    archive(nftData.nftIDHi);
+    archive(nftData.nftIDLo);
+    archive(nftData.creatorFeeBips);
+}
+
+template <typename Archive> void serialize(Archive &archive, Witness &state)
+{
+    archive(state.storageUpdate_A);
+    archive(state.storageUpdate_B);
+
+    archive(state.balanceUpdateS_A);
+    archive(state.balanceUpdateB_A);
+    archive(state.accountUpdate_A);
+
+    archive(state.balanceUpdateS_B);
+    archive(state.balanceUpdateB_B);
+    archive(state.accountUpdate_B);
+
+    archive(state.balanceUpdateA_O);
+    archive(state.balanceUpdateB_O);
+    archive(state.accountUpdate_O);
+
+    archive(state.balanceUpdateA_P);
+    archive(state.balanceUpdateB_P);
+
+    archive(state.signatureA);
+    archive(state.signatureB);
+
+    archive(state.numConditionalTransactionsAfter);
+}
+
+template <typename Archive> void serialize(Archive &archive, UniversalTransaction &transaction)
+{
+    archive(transaction.witness);
+    archive(transaction.type);
+    archive(transaction.spotTrade);
+    archive(transaction.transfer);
+    archive(transaction.withdraw);
+    archive(transaction.deposit);
+    archive(transaction.accountUpdate);
+    archive(transaction.ammUpdate);
+    archive(transaction.signatureVerification);
+    archive(transaction.nftMint);
+    archive(transaction.nftData);
+}
+
+template <typename Archive> void serialize(Archive &archive, Block &block)
+{
+    archive(block.exchange);
+
+    archive(block.merkleRootBefore);
+    archive(block.merkleRootAfter);
+
+    archive(block.timestamp);
+
+    archive(block.protocolTakerFeeBips);
+    archive(block.protocolMakerFeeBips);
+
+    archive(block.signature);
+
+    archive(block.accountUpdate_P);
+
+    archive(block.operatorAccountID);
+    archive(block.accountUpdate_O);
+
+    archive(block.transactions);
+}
+
+} // namespace Loopring
+
+#endif
@@ -0,0 +1,1076 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2017 Loopring Technology Limited.
+#ifndef _BLOCKDECODER_H_
+#define _BLOCKDECODER_H_
+
+#include "BlockingQueue.h"
+#include "Data.h"
+
+#include "ethsnarks.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef MULTICORE
+#include <omp.h>
+#endif
+
+using namespace ethsnarks;
+
+namespace Loopring
+{
+
+// Decodes a json block directly into a Block while it is being parsed (using the SAX
+// interface of the json parser), so the block is never stored as a json DOM.
+// The result is the same as from_json(const json &, Block &).
+// The parser only collects the values of a transaction, the values are converted to field
+// elements on worker threads while the parser continues with the next transactions.
+class BlockDecoder
+{
+  public:
+    // Called when the transactions start, with all block data except the transactions and
+    // the signature. Returns true to stream the transactions.
+    typedef std::function<bool(const Block &block)> HeaderHandler;
+    // Called for every transaction (in order) as soon as it is decoded
+    typedef std::function<bool(UniversalTransaction &transaction)> TransactionHandler;
+
+    BlockDecoder(Block &_block)
+        : block(_block),
+          blockType(0),
+          blockSize(0),
+          mode(Mode::Full),
+          streaming(false),
+          stopped(false),
+          numTransactions(0),
+          numWorkers(0)
+    {
+#ifdef MULTICORE
+        // The parser thread itself is busy parsing
+        numWorkers = std::max(0, omp_get_max_threads() - 1);
+#endif
+    }
+
+    ~BlockDecoder()
+    {
+        stopWorkers();
+    }
+
+    // Passes the transactions to `onTransaction` instead of storing them in the block.
+    // This is only possible when all other block data (except the signature) comes before
+    // the transactions, otherwise the transactions are stored in the block as usual.
+    void stream(const HeaderHandler &_onHeader, const TransactionHandler &_onTransaction)
+    {
+        mode = Mode::Stream;
+        onHeader = _onHeader;
+        onTransaction = _onTransaction;
+    }
+
+    // Only decodes the block data outside of the transactions. Stops at the transactions
+    // when the block size is already known.
+    void headerOnly()
+    {
+        mode = Mode::HeaderOnly;
+    }
+
+    // The number of threads converting the transaction values, without workers the values
+    // are converted on the parser thread
+    void setNumWorkers(unsigned int _numWorkers)
+    {
+        numWorkers = _numWorkers;
+    }
+
+    // Decodes a complete json block. On failure `error` contains the reason.
+    bool decode(std::istream &stream)
+    {
+        startWorkers();
+        return finish(json::sax_parse(stream, this) || stopped);
+    }
+
+    bool decode(const std::string &data)
+    {
+        startWorkers();
+        return finish(json::sax_parse(data, this) || stopped);
+    }
+
+    // True when the transactions were passed to the transaction handler
+    bool isStreaming() const
+    {
+        return streaming;
+    }
+
+    unsigned int getBlockType() const
+    {
+        return blockType;
+    }
+
+    unsigned int getBlockSize() const
+    {
+        return blockSize;
+    }
+
+    const std::string &getError() const
+    {
+        return error;
+    }
+
+    // SAX interface
+
+    bool null()
+    {
+        return true;
+    }
+
+    bool boolean(bool value)
+    {
+        return setValue(FieldT(value ? 1 : 0), value ? 1 : 0);
+    }
+
+    bool number_integer(json::number_integer_t value)
+    {
+        return setValue(FieldT(long(value)), value);
+    }
+
+    bool number_unsigned(json::number_unsigned_t value)
+    {
+        if (value > (unsigned long)LONG_MAX)
+        {
+            return setValue(FieldT(std::to_string(value).c_str()), 0);
+        }
+        return setValue(FieldT(long(value)), value);
+    }
+
+    bool number_float(json::number_float_t, const std::string &)
+    {
+        if (isIgnored())
+        {
+            return true;
+        }
+        return fail("floating point value for '" + currentKey + "'");
+    }
+
+    bool string(json::string_t &value)
+    {
+        if (isIgnored())
+        {
+            return true;
+        }
+        if (stack.back().kind == Kind::Proof)
+        {
+            return addProofValue(value);
+        }
+        if (pending)
+        {
+            // Converted together with the rest of the transaction
+            FieldT *field = getField(stack.back());
+            if (field)
+            {
+                pending->values.emplace_back(field, std::move(value));
+            }
+            return true;
+        }
+        return setValue(FieldT(value.c_str()), 0);
+    }
+
+    template <typename T> bool binary(T &)
+    {
+        return fail("unexpected binary value");
+    }
+
+    bool start_object(std::size_t)
+    {
+        if (stack.empty())
+        {
+            stack.push_back(Frame{Kind::Block, &block, 0});
+            return true;
+        }
+        return push(false);
+    }
+
+    bool key(json::string_t &value)
+    {
+        currentKey = value;
+        return true;
+    }
+
+    bool end_object()
+    {
+        Frame &frame = stack.back();
+        if (frame.kind == Kind::Transaction)
+        {
+            finishTransaction(pending->transaction, frame.flags);
+            if (!addTransaction())
+            {
+                return false;
+            }
+        }
+        else if (frame.kind == Kind::Witness)
+        {
+            if (!(frame.flags & HAS_SIGNATURE_B))
+            {
+                // Signature A may not be converted yet
+                pending->copySignature = true;
+            }
+        }
+        stack.pop_back();
+        return true;
+    }
+
+    bool start_array(std::size_t)
+    {
+        if (stack.empty())
+        {
+            return fail("block is not an object");
+        }
+        return push(true);
+    }
+
+    bool end_array()
+    {
+        stack.pop_back();
+        return true;
+    }
+
+    bool parse_error(std::size_t position, const std::string &, const std::exception &exception)
+    {
+        error = std::string("Failed to parse block at position ") + std::to_string(position) + ": " + exception.what();
+        return false;
+    }
+
+  private:
+    enum class Mode
+    {
+        Full,
+        Stream,
+        HeaderOnly
+    };
+
+    enum class Kind
+    {
+        Ignore,
+        Block,
+        Transactions,
+        Transaction,
+        Witness,
+        Proof,
+        StorageUpdate,
+        BalanceUpdate,
+        AccountUpdate,
+        StorageLeaf,
+        BalanceLeaf,
+        AccountLeaf,
+        Signature,
+        SpotTrade,
+        Order,
+        Transfer,
+        Withdrawal,
+        Deposit,
+        AccountUpdateTx,
+        AmmUpdate,
+        SignatureVerification,
+        NftMint,
+        NftData
+    };
+
+    // Transaction flags
+    static const unsigned int HAS_SPOT_TRADE = 1 << 0;
+    static const unsigned int HAS_TRANSFER = 1 << 1;
+    static const unsigned int HAS_WITHDRAW = 1 << 2;
+    static const unsigned int HAS_DEPOSIT = 1 << 3;
+    static const unsigned int HAS_ACCOUNT_UPDATE = 1 << 4;
+    static const unsigned int HAS_AMM_UPDATE = 1 << 5;
+    static const unsigned int HAS_SIGNATURE_VERIFICATION = 1 << 6;
+    static const unsigned int HAS_NFT_MINT = 1 << 7;
+    static const unsigned int HAS_NFT_DATA = 1 << 8;
+    // Witness flags
+    static const unsigned int HAS_SIGNATURE_B = 1 << 0;
+    // Block flags, the block data needed before the transactions can be streamed
+    static const unsigned int HAS_BLOCK_SIZE = 1 << 9;
+    static const unsigned int HAS_HEADER = (1 << 9) - 1;
+
+    struct Frame
+    {
+        Kind kind;
+        void *object;
+        unsigned int flags;
+    };
+
+    // A decoded transaction, of which the string values still need to be converted
+    struct PendingTransaction
+    {
+        UniversalTransaction transaction;
+        std::vector<std::pair<FieldT *, std::string>> values;
+        bool copySignature = false;
+        bool converted = false;
+    };
+
+    Block &block;
+    unsigned int blockType;
+    unsigned int blockSize;
+    std::vector<Frame> stack;
+    std::string currentKey;
+    std::string error;
+    ProofTable proofTable;
+    std::unordered_map<std::string, const FieldT *> proofValues;
+
+    Mode mode;
+    HeaderHandler onHeader;
+    TransactionHandler onTransaction;
+    bool streaming;
+    bool stopped;
+    // The transaction being decoded
+    std::shared_ptr<PendingTransaction> pending;
+    // The decoded transactions not passed on yet, in order
+    std::deque<std::shared_ptr<PendingTransaction>> decoded;
+    unsigned int numTransactions;
+
+    unsigned int numWorkers;
+    std::vector<std::thread> workers;
+    std::unique_ptr<BlockingQueue<std::shared_ptr<PendingTransaction>>> conversions;
+    std::mutex mtx;
+    std::condition_variable convertedCondition;
+
+    bool fail(const std::string &reason)
+    {
+        error = "Invalid block: " + reason;
+        return false;
+    }
+
+    bool finish(bool parsed)
+    {
+        // The transactions still being converted are passed on before the workers are stopped
+        const bool passed = parsed && passTransactions(true);
+        stopWorkers();
+        if (!passed)
+        {
+            return false;
+        }
+        if (!stack.empty() && !stopped)
+        {
+            return fail("incomplete block");
+        }
+        return true;
+    }
+
+    void startWorkers()
+    {
+        if (numWorkers == 0 || mode == Mode::HeaderOnly)
+        {
+            return;
+        }
+        // Only a few decoded transactions wait for a worker
+        conversions.reset(new BlockingQueue<std::shared_ptr<PendingTransaction>>(numWorkers * 2));
+        for (unsigned int w = 0; w < numWorkers; w++)
+        {
+            workers.emplace_back([this]() {
+                std::shared_ptr<PendingTransaction> transaction;
+                while (conversions->pop(transaction))
+                {
+                    convert(*transaction);
+                }
+            });
+        }
+    }
+
+    void stopWorkers()
+    {
+        if (conversions)
+        {
+            conversions->close();
+            for (std::thread &worker : workers)
+            {
+                worker.join();
+            }
+            workers.clear();
+            conversions.reset();
+        }
+    }
+
+    void convert(PendingTransaction &transaction)
+    {
+        for (const auto &value : transaction.values)
+        {
+            *value.first = FieldT(value.second.c_str());
+        }
+        std::vector<std::pair<FieldT *, std::string>>().swap(transaction.values);
+        if (transaction.copySignature)
+        {
+            Witness &witness = transaction.transaction.witness;
+            witness.signatureB = witness.signatureA;
+        }
+        {
+            const std::lock_guard<std::mutex> lock(mtx);
+            transaction.converted = true;
+        }
+        convertedCondition.notify_all();
+    }
+
+    // Converts the values of the decoded transaction (on a worker when there are workers)
+    bool addTransaction()
+    {
+        decoded.push_back(pending);
+        if (conversions)
+        {
+            conversions->push(pending);
+        }
+        else
+        {
+            convert(*pending);
+        }
+        pending.reset();
+        return passTransactions(false);
+    }
+
+    // Passes on the converted transactions in order, to the transaction handler when
+    // streaming, otherwise to the block. With `wait` all decoded transactions are passed on.
+    bool passTransactions(bool wait)
+    {
+        while (!decoded.empty())
+        {
+            PendingTransaction &transaction = *decoded.front();
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                if (!wait && !transaction.converted)
+                {
+                    return true;
+                }
+                convertedCondition.wait(lock, [&transaction] { return transaction.converted; });
+            }
+            if (streaming)
+            {
+                if (!onTransaction(transaction.transaction))
+                {
+                    return fail("failed to process transaction " + std::to_string(numTransactions));
+                }
+            }
+            else
+            {
+                block.transactions.push_back(std::move(transaction.transaction));
+            }
+            numTransactions++;
+            decoded.pop_front();
+        }
+        return true;
+    }
+
+    bool isIgnored() const
+    {
+        return stack.empty() || stack.back().kind == Kind::Ignore;
+    }
+
+    // Same as the end of from_json(const json &, UniversalTransaction &)
+    static void finishTransaction(UniversalTransaction &transaction, unsigned int flags)
+    {
+        const std::pair<unsigned int, TransactionType> types[] = {
+          {HAS_SPOT_TRADE, TransactionType::SpotTrade},
+          {HAS_TRANSFER, TransactionType::Transfer},
+          {HAS_WITHDRAW, TransactionType::Withdrawal},
+          {HAS_DEPOSIT, TransactionType::Deposit},
+          {HAS_ACCOUNT_UPDATE, TransactionType::AccountUpdate},
+          {HAS_AMM_UPDATE, TransactionType::AmmUpdate},
+          {HAS_SIGNATURE_VERIFICATION, TransactionType::SignatureVerification},
+          {HAS_NFT_MINT, TransactionType::NftMint},
+          {HAS_NFT_DATA, TransactionType::NftData}};
+        unsigned int active = 0;
+        for (const auto &type : types)
+        {
+            if (flags & type.first)
+            {
+                transaction.type = FieldT(int(type.second));
+                active = type.first;
+                break;
+            }
+        }
+
+        // Only the data of the actual transaction type is kept
+        keepIf(transaction.spotTrade, active == HAS_SPOT_TRADE);
+        keepIf(transaction.transfer, active == HAS_TRANSFER);
+        keepIf(transaction.withdraw, active == HAS_WITHDRAW);
+        keepIf(transaction.deposit, active == HAS_DEPOSIT);
+        keepIf(transaction.accountUpdate, active == HAS_ACCOUNT_UPDATE);
+        keepIf(transaction.ammUpdate, active == HAS_AMM_UPDATE);
+        keepIf(transaction.signatureVerification, active == HAS_SIGNATURE_VERIFICATION);
+        keepIf(transaction.nftMint, active == HAS_NFT_MINT);
+        keepIf(transaction.nftData, active == HAS_NFT_DATA);
+    }
+
+    template <typename T> static void keepIf(std::shared_ptr<const T> &data, bool keep)
+    {
+        if (!keep)
+        {
+            data.reset();
+        }
+    }
+
+    // Pushes the frame for the object or array value of the current key (or array element)
+    bool push(bool isArray)
+    {
+        Frame &parent = stack.back();
+        Frame child{Kind::Ignore, nullptr, 0};
+        if (parent.kind == Kind::Transactions && !isArray)
+        {
+            // Every transaction is decoded into its own object, it is only passed on (to the
+            // block or the transaction handler) once all its values are converted
+            pending = std::make_shared<PendingTransaction>();
+            UniversalTransaction *tx = &pending->transaction;
+            tx->witness.signatureA = getDummyData().signature;
+            tx->witness.signatureB = tx->witness.signatureA;
+            child = Frame{Kind::Transaction, tx, 0};
+        }
+        else if (parent.kind != Kind::Ignore && parent.kind != Kind::Transactions && parent.kind != Kind::Proof)
+        {
+            child = getChild(parent, isArray);
+        }
+        if (child.kind == Kind::Transactions)
+        {
+            if (!startTransactions(parent, child))
+            {
+                return false;
+            }
+        }
+        if (child.kind == Kind::Proof)
+        {
+            Proof &proof = *(Proof *)child.object;
+            proof.table = proofTable.values;
+            proof.values.clear();
+        }
+        stack.push_back(child);
+        return true;
+    }
+
+    bool startTransactions(const Frame &blockFrame, Frame &child)
+    {
+        if (mode == Mode::HeaderOnly)
+        {
+            if (blockFrame.flags & HAS_BLOCK_SIZE)
+            {
+                // Everything needed is known, stop parsing
+                stopped = true;
+                return false;
+            }
+            child = Frame{Kind::Ignore, nullptr, 0};
+        }
+        else if (mode == Mode::Stream && (blockFrame.flags & HAS_HEADER) == HAS_HEADER)
+        {
+            streaming = onHeader(block);
+        }
+        return true;
+    }
+
+    // The proof values are shared by all proofs of the block, repeated values are only converted once.
+    // A value first seen in a transaction is converted with that transaction, the transactions
+    // using it later are passed on after it.
+    bool addProofValue(const std::string &value)
+    {
+        auto it = proofValues.find(value);
+        if (it == proofValues.end())
+        {
+            if (pending)
+            {
+                FieldT *field = proofTable.reserve();
+                pending->values.emplace_back(field, value);
+                it = proofValues.emplace(value, field).first;
+            }
+            else
+            {
+                it = proofValues.emplace(value, proofTable.get(proofTable.intern(FieldT(value.c_str())))).first;
+            }
+        }
+        ((Proof *)stack.back().object)->values.push_back(it->second);
+        return true;
+    }
+
+    struct Child
+    {
+        const char *key;
+        Kind kind;
+        void *object;
+        unsigned int flag;
+    };
+
+    Frame findChild(Frame &parent, std::initializer_list<Child> children) const
+    {
+        for (const Child &child : children)
+        {
+            if (currentKey == child.key)
+            {
+                parent.flags |= child.flag;
+                return Frame{child.kind, child.object, 0};
+            }
+        }
+        return Frame{Kind::Ignore, nullptr, 0};
+    }
+
+    // The transaction data is decoded into a new object
+    template <typename T>
+    static Frame newData(Frame &parent, std::shared_ptr<const T> &data, Kind kind, unsigned int flag)
+    {
+        std::shared_ptr<T> object = std::make_shared<T>();
+        data = object;
+        parent.flags |= flag;
+        return Frame{kind, object.get(), 0};
+    }
+
+    Frame getChild(Frame &parent, bool isArray)
+    {
+        if (isArray)
+        {
+            switch (parent.kind)
+            {
+                case Kind::Block:
+                    return findChild(parent, {{"transactions", Kind::Transactions, parent.object, 0}});
+                case Kind::StorageUpdate:
+                    return findChild(parent, {{"proof", Kind::Proof, &((StorageUpdate *)parent.object)->proof, 0}});
+                case Kind::BalanceUpdate:
+                    return findChild(parent, {{"proof", Kind::Proof, &((BalanceUpdate *)parent.object)->proof, 0}});
+                case Kind::AccountUpdate:
+                    return findChild(parent, {{"proof", Kind::Proof, &((AccountUpdate *)parent.object)->proof, 0}});
+                default:
+                    return Frame{Kind::Ignore, nullptr, 0};
+            }
+        }
+
+        switch (parent.kind)
+        {
+            case Kind::Block:
+            {
+                Block &b = *(Block *)parent.object;
+                return findChild(
+                  parent,
+                  {{"signature", Kind::Signature, &b.signature, 0},
+                   {"accountUpdate_P", Kind::AccountUpdate, &b.accountUpdate_P, getHeaderFlag("accountUpdate_P")},
+                   {"accountUpdate_O", Kind::AccountUpdate, &b.accountUpdate_O, getHeaderFlag("accountUpdate_O")}});
+            }
+            case Kind::Transaction:
+            {
+                UniversalTransaction &tx = *(UniversalTransaction *)parent.object;
+                if (currentKey == "witness")
+                {
+                    return Frame{Kind::Witness, &tx.witness, 0};
+                }
+                if (currentKey == "spotTrade")
+                {
+                    return newData(parent, tx.spotTrade, Kind::SpotTrade, HAS_SPOT_TRADE);
+                }
+                if (currentKey == "transfer")
+                {
+                    return newData(parent, tx.transfer, Kind::Transfer, HAS_TRANSFER);
+                }
+                if (currentKey == "withdraw")
+                {
+                    return newData(parent, tx.withdraw, Kind::Withdrawal, HAS_WITHDRAW);
+                }
+                if (currentKey == "deposit")
+                {
+                    return newData(parent, tx.deposit, Kind::Deposit, HAS_DEPOSIT);
+                }
+                if (currentKey == "accountUpdate")
+                {
+                    return newData(parent, tx.accountUpdate, Kind::AccountUpdateTx, HAS_ACCOUNT_UPDATE);
+                }
+                if (currentKey == "ammUpdate")
+                {
+                    return newData(parent, tx.ammUpdate, Kind::AmmUpdate, HAS_AMM_UPDATE);
+                }
+                if (currentKey == "signatureVerification")
+                {
+                    return newData(
+                      parent, tx.signatureVerification, Kind::SignatureVerification, HAS_SIGNATURE_VERIFICATION);
+                }
+                if (currentKey == "nftMint")
+                {
+                    return newData(parent, tx.nftMint, Kind::NftMint, HAS_NFT_MINT);
+                }
+                if (currentKey == "nftData")
+                {
+                    return newData(parent, tx.nftData, Kind::NftData, HAS_NFT_DATA);
+                }
+                return Frame{Kind::Ignore, nullptr, 0};
+            }
+            case Kind::Witness:
+            {
+                Witness &w = *(Witness *)parent.object;
+                return findChild(
+                  parent,
+                  {{"storageUpdate_A", Kind::StorageUpdate, &w.storageUpdate_A, 0},
+                   {"storageUpdate_B", Kind::StorageUpdate, &w.storageUpdate_B, 0},
+                   {"balanceUpdateS_A", Kind::BalanceUpdate, &w.balanceUpdateS_A, 0},
+                   {"balanceUpdateB_A", Kind::BalanceUpdate, &w.balanceUpdateB_A, 0},
+                   {"accountUpdate_A", Kind::AccountUpdate, &w.accountUpdate_A, 0},
+                   {"balanceUpdateS_B", Kind::BalanceUpdate, &w.balanceUpdateS_B, 0},
+                   {"balanceUpdateB_B", Kind::BalanceUpdate, &w.balanceUpdateB_B, 0},
+                   {"accountUpdate_B", Kind::AccountUpdate, &w.accountUpdate_B, 0},
+                   {"balanceUpdateA_O", Kind::BalanceUpdate, &w.balanceUpdateA_O, 0},
+                   {"balanceUpdateB_O", Kind::BalanceUpdate, &w.balanceUpdateB_O, 0},
+                   {"accountUpdate_O", Kind::AccountUpdate, &w.accountUpdate_O, 0},
+                   {"balanceUpdateA_P", Kind::BalanceUpdate, &w.balanceUpdateA_P, 0},
+                   {"balanceUpdateB_P", Kind::BalanceUpdate, &w.balanceUpdateB_P, 0},
+                   {"signatureA", Kind::Signature, &w.signatureA, 0},
+                   {"signatureB", Kind::Signature, &w.signatureB, HAS_SIGNATURE_B}});
+            }
+            case Kind::StorageUpdate:
+            {
+                StorageUpdate &update = *(StorageUpdate *)parent.object;
+                return findChild(
+                  parent,
+                  {{"before", Kind::StorageLeaf, &update.before, 0}, {"after", Kind::StorageLeaf, &update.after, 0}});
+            }
+            case Kind::BalanceUpdate:
+            {
+                BalanceUpdate &update = *(BalanceUpdate *)parent.object;
+                return findChild(
+                  parent,
+                  {{"before", Kind::BalanceLeaf, &update.before, 0}, {"after", Kind::BalanceLeaf, &update.after, 0}});
+            }
+            case Kind::AccountUpdate:
+            {
+                AccountUpdate &update = *(AccountUpdate *)parent.object;
+                return findChild(
+                  parent,
+                  {{"before", Kind::AccountLeaf, &update.before, 0}, {"after", Kind::AccountLeaf, &update.after, 0}});
+            }
+            case Kind::SpotTrade:
+            {
+                SpotTrade &spotTrade = *(SpotTrade *)parent.object;
+                return findChild(
+                  parent,
+                  {{"orderA", Kind::Order, &spotTrade.orderA, 0}, {"orderB", Kind::Order, &spotTrade.orderB, 0}});
+            }
+            default:
+                return Frame{Kind::Ignore, nullptr, 0};
+        }
+    }
+
+    // Sets the scalar value of the current key (or appends it to the current array).
+    // `number` is the value as an integer, only used for the block meta data.
+    bool setValue(const FieldT &value, unsigned long number)
+    {
+        if (isIgnored())
+        {
+            return true;
+        }
+        Frame &frame = stack.back();
+        if (frame.kind == Kind::Proof)
+        {
+            ((Proof *)frame.object)->values.push_back(proofTable.get(proofTable.intern(value)));
+            return true;
+        }
+        if (frame.kind == Kind::Block)
+        {
+            if (currentKey == "blockType")
+            {
+                blockType = number;
+                return true;
+            }
+            if (currentKey == "blockSize")
+            {
+                blockSize = number;
+                frame.flags |= HAS_BLOCK_SIZE;
+                return true;
+            }
+        }
+        FieldT *field = getField(frame);
+        if (field)
+        {
+            *field = value;
+            if (frame.kind == Kind::Block)
+            {
+                frame.flags |= getHeaderFlag(currentKey);
+            }
+        }
+        return true;
+    }
+
+    static unsigned int getHeaderFlag(const std::string &key)
+    {
+        static const char *const keys[] = {
+          "exchange",
+          "merkleRootBefore",
+          "merkleRootAfter",
+          "timestamp",
+          "protocolTakerFeeBips",
+          "protocolMakerFeeBips",
+          "operatorAccountID",
+          "accountUpdate_P",
+          "accountUpdate_O"};
+        for (unsigned int i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+        {
+            if (key == keys[i])
+            {
+                return 1 << i;
+            }
+        }
+        return 0;
+    }
+
+    template <typename T>
+    FieldT *findField(T &object, std::initializer_list<std::pair<const char *, FieldT T::*>> fields) const
+    {
+        for (const auto &field : fields)
+        {
+            if (currentKey == field.first)
+            {
+                return &(object.*field.second);
+            }
+        }
+        return nullptr;
+    }
+
+    FieldT *getField(const Frame &frame) const
+    {
+        switch (frame.kind)
+        {
+            case Kind::Block:
+            {
+                Block &b = *(Block *)frame.object;
+                return findField(
+                  b,
+                  {{"exchange", &Block::exchange},
+                   {"merkleRootBefore", &Block::merkleRootBefore},
+                   {"merkleRootAfter", &Block::merkleRootAfter},
+                   {"timestamp", &Block::timestamp},
+                   {"protocolTakerFeeBips", &Block::protocolTakerFeeBips},
+                   {"protocolMakerFeeBips", &Block::protocolMakerFeeBips},
+                   {"operatorAccountID", &Block::operatorAccountID}});
+            }
+            case Kind::Witness:
+            {
+                Witness &w = *(Witness *)frame.object;
+                return findField(w, {{"numConditionalTransactionsAfter", &Witness::numConditionalTransactionsAfter}});
+            }
+            case Kind::StorageUpdate:
+            {
+                StorageUpdate &update = *(StorageUpdate *)frame.object;
+                return findField(
+                  update,
+                  {{"storageID", &StorageUpdate::storageID},
+                   {"rootBefore", &StorageUpdate::rootBefore},
+                   {"rootAfter", &StorageUpdate::rootAfter}});
+            }
+            case Kind::BalanceUpdate:
+            {
+                BalanceUpdate &update = *(BalanceUpdate *)frame.object;
+                return findField(
+                  update,
+                  {{"tokenID", &BalanceUpdate::tokenID},
+                   {"rootBefore", &BalanceUpdate::rootBefore},
+                   {"rootAfter", &BalanceUpdate::rootAfter}});
+            }
+            case Kind::AccountUpdate:
+            {
+                AccountUpdate &update = *(AccountUpdate *)frame.object;
+                return findField(
+                  update,
+                  {{"accountID", &AccountUpdate::accountID},
+                   {"rootBefore", &AccountUpdate::rootBefore},
+                   {"rootAfter", &AccountUpdate::rootAfter}});
+            }
+            case Kind::StorageLeaf:
+            {
+                StorageLeaf &leaf = *(StorageLeaf *)frame.object;
+                return findField(leaf, {{"data", &StorageLeaf::data}, {"storageID", &StorageLeaf::storageID}});
+            }
+            case Kind::BalanceLeaf:
+            {
+                BalanceLeaf &leaf = *(BalanceLeaf *)frame.object;
+                return findField(
+                  leaf,
+                  {{"balance", &BalanceLeaf::balance},
+                   {"weightAMM", &BalanceLeaf::weightAMM},
+                   {"storageRoot", &BalanceLeaf::storageRoot}});
+            }
+            case Kind::AccountLeaf:
+            {
+                AccountLeaf &account = *(AccountLeaf *)frame.object;
+                if (currentKey == "publicKeyX")
+                {
+                    return &account.publicKey.x;
+                }
+                if (currentKey == "publicKeyY")
+                {
+                    return &account.publicKey.y;
+                }
+                return findField(
+                  account,
+                  {{"owner", &AccountLeaf::owner},
+                   {"nonce", &AccountLeaf::nonce},
+                   {"feeBipsAMM", &AccountLeaf::feeBipsAMM},
+                   {"balancesRoot", &AccountLeaf::balancesRoot}});
+            }
+            case Kind::Signature:
+            {
+                Signature &signature = *(Signature *)frame.object;
+                if (currentKey == "Rx")
+                {
+                    return &signature.R.x;
+                }
+                if (currentKey == "Ry")
+                {
+                    return &signature.R.y;
+                }
+                return findField(signature, {{"s", &Signature::s}});
+            }
+            case Kind::SpotTrade:
+            {
+                SpotTrade &spotTrade = *(SpotTrade *)frame.object;
+                return findField(spotTrade, {{"fFillS_A", &SpotTrade::fillS_A}, {"fFillS_B", &SpotTrade::fillS_B}});
+            }
+            case Kind::Order:
+            {
+                Order &order = *(Order *)frame.object;
+                return findField(
+                  order,
+                  {{"storageID", &Order::storageID},
+                   {"accountID", &Order::accountID},
+                   {"tokenS", &Order::tokenS},
+                   {"tokenB", &Order::tokenB},
+                   {"amountS", &Order::amountS},
+                   {"amountB", &Order::amountB},
+                   {"validUntil", &Order::validUntil},
+                   {"maxFeeBips", &Order::maxFeeBips},
+                   {"fillAmountBorS", &Order::fillAmountBorS},
+                   {"taker", &Order::taker},
+                   {"nftDataB", &Order::nftDataB},
+                   {"feeBips", &Order::feeBips},
+                   {"amm", &Order::amm}});
+            }
+            case Kind::Transfer:
+            {
+                Transfer &transfer = *(Transfer *)frame.object;
+                return findField(
+                  transfer,
+                  {{"fromAccountID", &Transfer::fromAccountID},
+                   {"toAccountID", &Transfer::toAccountID},
+                   {"tokenID", &Transfer::tokenID},
+                   {"amount", &Transfer::amount},
+                   {"feeTokenID", &Transfer::feeTokenID},
+                   {"fee", &Transfer::fee},
+                   {"validUntil", &Transfer::validUntil},
+                   {"to", &Transfer::to},
+                   {"dualAuthorX", &Transfer::dualAuthorX},
+                   {"dualAuthorY", &Transfer::dualAuthorY},
+                   {"storageID", &Transfer::storageID},
+                   {"payerToAccountID", &Transfer::payerToAccountID},
+                   {"payerTo", &Transfer::payerTo},
+                   {"payeeToAccountID", &Transfer::payeeToAccountID},
+                   {"maxFee", &Transfer::maxFee},
+                   {"putAddressesInDA", &Transfer::putAddressesInDA},
+                   {"type", &Transfer::type},
+                   {"toTokenID", &Transfer::toTokenID}});
+            }
+            case Kind::Withdrawal:
+            {
+                Withdrawal &withdrawal = *(Withdrawal *)frame.object;
+                return findField(
+                  withdrawal,
+                  {{"accountID", &Withdrawal::accountID},
+                   {"tokenID", &Withdrawal::tokenID},
+                   {"amount", &Withdrawal::amount},
+                   {"feeTokenID", &Withdrawal::feeTokenID},
+                   {"fee", &Withdrawal::fee},
+                   {"onchainDataHash", &Withdrawal::onchainDataHash},
+                   {"storageID", &Withdrawal::storageID},
+                   {"validUntil", &Withdrawal::validUntil},
+                   {"maxFee", &Withdrawal::maxFee},
+                   {"type", &Withdrawal::type}});
+            }
+            case Kind::Deposit:
+            {
+                Deposit &deposit = *(Deposit *)frame.object;
+                return findField(
+                  deposit,
+                  {{"owner", &Deposit::owner},
+                   {"accountID", &Deposit::accountID},
+                   {"tokenID", &Deposit::tokenID},
+                   {"amount", &Deposit::amount}});
+            }
+            case Kind::AccountUpdateTx:
+            {
+                AccountUpdateTx &update = *(AccountUpdateTx *)frame.object;
+                return findField(
+                  update,
+                  {{"owner", &AccountUpdateTx::owner},
+                   {"accountID", &AccountUpdateTx::accountID},
+                   {"publicKeyX", &AccountUpdateTx::publicKeyX},
+                   {"publicKeyY", &AccountUpdateTx::publicKeyY},
+                   {"feeTokenID", &AccountUpdateTx::feeTokenID},
+                   {"fee", &AccountUpdateTx::fee},
+                   {"maxFee", &AccountUpdateTx::maxFee},
+                   {"validUntil", &AccountUpdateTx::validUntil},
+                   {"type", &AccountUpdateTx::type}});
+            }
+            case Kind::AmmUpdate:
+            {
+                AmmUpdate &update = *(AmmUpdate *)frame.object;
+                return findField(
+                  update,
+                  {{"accountID", &AmmUpdate::accountID},
+                   {"tokenID", &AmmUpdate::tokenID},
+                   {"feeBips", &AmmUpdate::feeBips},
+                   {"tokenWeight", &AmmUpdate::tokenWeight}});
+            }
+            case Kind::SignatureVerification:
+            {
+                SignatureVerification &verification = *(SignatureVerification *)frame.object;
+                return findField(
+                  verification,
+                  {{"accountID", &SignatureVerification::accountID},
+                   {"data", &SignatureVerification::data}});
+            }
+            case Kind::NftMint:
+            {
+                NftMint &nftMint = *(NftMint *)frame.object;
+                return findField(
+                  nftMint,
+                  {{"minterAccountID", &NftMint::minterAccountID},
+                   {"tokenAccountID", &NftMint::tokenAccountID},
+                   {"amount", &NftMint::amount},
+                   {"feeTokenID", &NftMint::feeTokenID},
+                   {"fee", &NftMint::fee},
+                   {"validUntil", &NftMint::validUntil},
+                   {"maxFee", &NftMint::maxFee},
+                   {"type", &NftMint::type},
+                   {"nftType", &NftMint::nftType},
+                   {"tokenAddress", &NftMint::tokenAddress},
+                   {"nftIDHi", &NftMint::nftIDHi},
+                   {"nftIDLo", &NftMint::nftIDLo},
+                   {"creatorFeeBips", &NftMint::creatorFeeBips},
+                   {"toAccountID", &NftMint::toAccountID},
+                   {"toTokenID", &NftMint::toTokenID},
+                   {"to", &NftMint::to},
+                   {"storageID", &NftMint::storageID}});
+            }
+            case Kind::NftData:
+            {
+                NftData &nftData = *(NftData *)frame.object;
+                return findField(
+                  nftData,
+                  {{"type", &NftData::type},
+                   {"accountID", &NftData::accountID},
+                   {"tokenID", &NftData::tokenID},
+                   {"minter", &NftData::minter},
+                   {"nftType", &NftData::nftType},
+                   {"tokenAddress", &NftData::tokenAddress},
+                   {"nftIDHi", &NftData::nftIDHi},
+                   {"nftIDLo", &NftData::nftIDLo},
+                   {"creatorFeeBips", &NftData::creatorFeeBips}});
+            }
+            default:
+                return nullptr;
+        }
+    }
+};
+
+} // namespace Loopring
+
+#endif
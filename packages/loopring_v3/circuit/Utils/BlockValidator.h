@@ -0,0 +1,390 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2017 Loopring Technology Limited.
+#ifndef _BLOCKVALIDATOR_H_
+#define _BLOCKVALIDATOR_H_
+
+#include "Constants.h"
+#include "Data.h"
+#include "NativeMerkleTree.h"
+
+#include "ethsnarks.hpp"
+#include "jubjub/point.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace ethsnarks;
+
+namespace Loopring
+{
+
+// Checks the state transitions of a block without the circuit, so an invalid block is
+// rejected before any witness is generated:
+// - the roots before and after every Merkle tree update match their leaves and proofs
+// - the roots are chained the same way the circuit chains them, from merkleRootBefore
+//   to merkleRootAfter
+// - the R point of every signature is on the curve
+// - the values the circuit range limits fit
+// These checks are not complete, a block that passes can still be invalid (e.g. the
+// transactions themselves are only checked by the circuit).
+class BlockValidator
+{
+  public:
+    BlockValidator(const Block &_block)
+        : block(_block), accounts(TREE_DEPTH_ACCOUNTS), balances(TREE_DEPTH_TOKENS), storage(TREE_DEPTH_STORAGE)
+    {
+    }
+
+    // Returns false with the reason in `error` for the first check that fails
+    bool validate(std::string &error)
+    {
+        computeRoots();
+
+        if (!checkBlockInputs(error))
+        {
+            return false;
+        }
+        FieldT accountsRoot = block.merkleRootBefore;
+        FieldT protocolBalancesRoot = block.accountUpdate_P.before.balancesRoot;
+        for (size_t i = 0; i < block.transactions.size(); i++)
+        {
+            if (!checkTransaction(i, accountsRoot, protocolBalancesRoot, error))
+            {
+                error = "Transaction " + std::to_string(i) + ": " + error;
+                return false;
+            }
+        }
+        return checkBlockUpdates(accountsRoot, protocolBalancesRoot, error);
+    }
+
+  private:
+    // A Merkle tree update with the indices of its computed roots
+    struct Update
+    {
+        const char *name;
+        MerkleRootBatch *tree;
+        uint64_t address;
+        const Proof *proof;
+        FieldT leafBefore;
+        FieldT leafAfter;
+        size_t rootBefore;
+        size_t rootAfter;
+        const FieldT *expectedRootBefore;
+        const FieldT *expectedRootAfter;
+    };
+
+    const Block &block;
+    jubjub::Params params;
+
+    MerkleRootBatch accounts;
+    MerkleRootBatch balances;
+    MerkleRootBatch storage;
+
+    // The updates of every transaction, in the order the circuit does them
+    std::vector<std::vector<Update>> transactionUpdates;
+    // The updates of the protocol pool and the operator at the end of the block
+    std::vector<Update> blockUpdates;
+
+    template <typename LeafT>
+    Update makeUpdate(
+      const char *name,
+      MerkleRootBatch &tree,
+      const FieldT &address,
+      const Proof &proof,
+      const LeafT &before,
+      const LeafT &after,
+      const FieldT &rootBefore,
+      const FieldT &rootAfter)
+    {
+        return {name, &tree, toAddress(address), &proof, hashLeaf(before), hashLeaf(after), 0, 0, &rootBefore, &rootAfter};
+    }
+
+    Update makeUpdate(const char *name, const StorageUpdate &update)
+    {
+        return makeUpdate(
+          name, storage, update.storageID, update.proof, update.before, update.after, update.rootBefore, update.rootAfter);
+    }
+
+    Update makeUpdate(const char *name, const BalanceUpdate &update)
+    {
+        return makeUpdate(
+          name, balances, update.tokenID, update.proof, update.before, update.after, update.rootBefore, update.rootAfter);
+    }
+
+    Update makeUpdate(const char *name, const AccountUpdate &update)
+    {
+        return makeUpdate(
+          name, accounts, update.accountID, update.proof, update.before, update.after, update.rootBefore, update.rootAfter);
+    }
+
+    // Computes the roots of all updates. The leaves are hashed for every transaction in
+    // parallel, all paths of a tree are hashed up together.
+    void computeRoots()
+    {
+        const int numTransactions = block.transactions.size();
+        transactionUpdates.resize(numTransactions);
+#ifdef MULTICORE
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < numTransactions; i++)
+        {
+            const Witness &witness = block.transactions[i].witness;
+            transactionUpdates[i] = {
+              makeUpdate("storageUpdate_A", witness.storageUpdate_A),
+              makeUpdate("balanceUpdateS_A", witness.balanceUpdateS_A),
+              makeUpdate("balanceUpdateB_A", witness.balanceUpdateB_A),
+              makeUpdate("accountUpdate_A", witness.accountUpdate_A),
+              makeUpdate("storageUpdate_B", witness.storageUpdate_B),
+              makeUpdate("balanceUpdateS_B", witness.balanceUpdateS_B),
+              makeUpdate("balanceUpdateB_B", witness.balanceUpdateB_B),
+              makeUpdate("accountUpdate_B", witness.accountUpdate_B),
+              makeUpdate("balanceUpdateB_O", witness.balanceUpdateB_O),
+              makeUpdate("balanceUpdateA_O", witness.balanceUpdateA_O),
+              makeUpdate("accountUpdate_O", witness.accountUpdate_O),
+              makeUpdate("balanceUpdateB_P", witness.balanceUpdateB_P),
+              makeUpdate("balanceUpdateA_P", witness.balanceUpdateA_P)};
+        }
+        blockUpdates = {
+          makeUpdate("accountUpdate_P", block.accountUpdate_P), makeUpdate("accountUpdate_O", block.accountUpdate_O)};
+
+        for (std::vector<Update> &updates : transactionUpdates)
+        {
+            addPaths(updates);
+        }
+        addPaths(blockUpdates);
+        accounts.compute();
+        balances.compute();
+        storage.compute();
+    }
+
+    void addPaths(std::vector<Update> &updates)
+    {
+        for (Update &update : updates)
+        {
+            update.rootBefore = update.tree->add(update.leafBefore, update.address, *update.proof);
+            update.rootAfter = update.tree->add(update.leafAfter, update.address, *update.proof);
+        }
+    }
+
+    bool checkRoots(const Update &update, std::string &error) const
+    {
+        if (update.tree->getRoot(update.rootBefore) != *update.expectedRootBefore)
+        {
+            error = std::string(update.name) + ": the root before does not match the leaf and the proof";
+            return false;
+        }
+        if (update.tree->getRoot(update.rootAfter) != *update.expectedRootAfter)
+        {
+            error = std::string(update.name) + ": the root after does not match the leaf and the proof";
+            return false;
+        }
+        return true;
+    }
+
+    static bool check(bool condition, const std::string &message, std::string &error)
+    {
+        if (!condition)
+        {
+            error = message;
+        }
+        return condition;
+    }
+
+    static bool fits(const FieldT &value, unsigned int numBits)
+    {
+        return value.as_bigint().num_bits() <= numBits;
+    }
+
+    // The R point is always validated by EdDSA_Poseidon, even when the signature isn't required
+    bool isOnCurve(const jubjub::EdwardsPoint &point) const
+    {
+        const FieldT xx = point.x * point.x;
+        const FieldT yy = point.y * point.y;
+        return params.a * xx + yy == FieldT::one() + params.d * xx * yy;
+    }
+
+    bool checkBalance(const BalanceUpdate &update, const char *name, std::string &error) const
+    {
+        return check(fits(update.tokenID, NUM_BITS_TOKEN), std::string(name) + ": invalid tokenID", error) &&
+               check(
+                 fits(update.before.balance, NUM_BITS_AMOUNT) && fits(update.after.balance, NUM_BITS_AMOUNT),
+                 std::string(name) + ": balance too large",
+                 error);
+    }
+
+    bool checkBlockInputs(std::string &error) const
+    {
+        return check(fits(block.exchange, NUM_BITS_ADDRESS), "Invalid exchange", error) &&
+               check(fits(block.timestamp, NUM_BITS_TIMESTAMP), "Invalid timestamp", error) &&
+               check(fits(block.protocolTakerFeeBips, NUM_BITS_PROTOCOL_FEE_BIPS), "Invalid protocolTakerFeeBips", error) &&
+               check(fits(block.protocolMakerFeeBips, NUM_BITS_PROTOCOL_FEE_BIPS), "Invalid protocolMakerFeeBips", error) &&
+               check(fits(block.operatorAccountID, NUM_BITS_ACCOUNT), "Invalid operatorAccountID", error) &&
+               check(isOnCurve(block.signature.R), "Invalid block signature", error);
+    }
+
+    bool checkTransaction(size_t index, FieldT &accountsRoot, FieldT &protocolBalancesRoot, std::string &error) const
+    {
+        const UniversalTransaction &tx = block.transactions[index];
+        const Witness &witness = tx.witness;
+
+        if (!check(
+              fits(tx.type, 64) && tx.type.as_ulong() < (unsigned long)TransactionType::COUNT,
+              "Invalid transaction type",
+              error))
+        {
+            return false;
+        }
+
+        // Numeric limits
+        for (const AccountUpdate *update : {&witness.accountUpdate_A, &witness.accountUpdate_B, &witness.accountUpdate_O})
+        {
+            if (!check(fits(update->accountID, NUM_BITS_ACCOUNT), "Invalid accountID", error))
+            {
+                return false;
+            }
+        }
+        for (const StorageUpdate *update : {&witness.storageUpdate_A, &witness.storageUpdate_B})
+        {
+            if (!check(fits(update->storageID, NUM_BITS_STORAGEID), "Invalid storageID", error))
+            {
+                return false;
+            }
+        }
+        if (!checkBalance(witness.balanceUpdateS_A, "balanceUpdateS_A", error) ||
+            !checkBalance(witness.balanceUpdateB_A, "balanceUpdateB_A", error) ||
+            !checkBalance(witness.balanceUpdateS_B, "balanceUpdateS_B", error) ||
+            !checkBalance(witness.balanceUpdateB_B, "balanceUpdateB_B", error) ||
+            !checkBalance(witness.balanceUpdateB_O, "balanceUpdateB_O", error) ||
+            !checkBalance(witness.balanceUpdateA_O, "balanceUpdateA_O", error) ||
+            !checkBalance(witness.balanceUpdateB_P, "balanceUpdateB_P", error) ||
+            !checkBalance(witness.balanceUpdateA_P, "balanceUpdateA_P", error))
+        {
+            return false;
+        }
+
+        // Signatures
+        if (!check(isOnCurve(witness.signatureA.R), "Invalid signatureA", error) ||
+            !check(isOnCurve(witness.signatureB.R), "Invalid signatureB", error))
+        {
+            return false;
+        }
+
+        // Merkle proofs
+        for (const Update &update : transactionUpdates[index])
+        {
+            if (!checkRoots(update, error))
+            {
+                return false;
+            }
+        }
+
+        // Root chaining
+        // Account A and B: storage -> balance S -> balance B -> account
+        const StorageUpdate *storageUpdates[] = {&witness.storageUpdate_A, &witness.storageUpdate_B};
+        const BalanceUpdate *balanceUpdatesS[] = {&witness.balanceUpdateS_A, &witness.balanceUpdateS_B};
+        const BalanceUpdate *balanceUpdatesB[] = {&witness.balanceUpdateB_A, &witness.balanceUpdateB_B};
+        const AccountUpdate *accountUpdates[] = {&witness.accountUpdate_A, &witness.accountUpdate_B};
+        const std::string accountNames[] = {"A", "B"};
+        for (unsigned int j = 0; j < 2; j++)
+        {
+            const StorageUpdate &storageUpdate = *storageUpdates[j];
+            const BalanceUpdate &balanceUpdateS = *balanceUpdatesS[j];
+            const BalanceUpdate &balanceUpdateB = *balanceUpdatesB[j];
+            const AccountUpdate &accountUpdate = *accountUpdates[j];
+            const std::string &name = accountNames[j];
+            if (!check(
+                  storageUpdate.rootBefore == balanceUpdateS.before.storageRoot &&
+                    storageUpdate.rootAfter == balanceUpdateS.after.storageRoot,
+                  "storageUpdate_" + name + " is not chained to balanceUpdateS_" + name,
+                  error) ||
+                !check(
+                  balanceUpdateS.rootBefore == accountUpdate.before.balancesRoot,
+                  "balanceUpdateS_" + name + " is not chained to accountUpdate_" + name,
+                  error) ||
+                !check(
+                  balanceUpdateB.rootBefore == balanceUpdateS.rootAfter,
+                  "balanceUpdateB_" + name + " is not chained to balanceUpdateS_" + name,
+                  error) ||
+                !check(
+                  accountUpdate.after.balancesRoot == balanceUpdateB.rootAfter,
+                  "accountUpdate_" + name + " is not chained to balanceUpdateB_" + name,
+                  error) ||
+                !check(
+                  accountUpdate.rootBefore == accountsRoot,
+                  "accountUpdate_" + name + " is not chained to the previous accounts root",
+                  error))
+            {
+                return false;
+            }
+            accountsRoot = accountUpdate.rootAfter;
+        }
+        // Operator: balance B -> balance A -> account
+        if (!check(
+              witness.balanceUpdateB_O.rootBefore == witness.accountUpdate_O.before.balancesRoot,
+              "balanceUpdateB_O is not chained to accountUpdate_O",
+              error) ||
+            !check(
+              witness.balanceUpdateA_O.rootBefore == witness.balanceUpdateB_O.rootAfter,
+              "balanceUpdateA_O is not chained to balanceUpdateB_O",
+              error) ||
+            !check(
+              witness.accountUpdate_O.after.balancesRoot == witness.balanceUpdateA_O.rootAfter,
+              "accountUpdate_O is not chained to balanceUpdateA_O",
+              error) ||
+            !check(
+              witness.accountUpdate_O.rootBefore == accountsRoot,
+              "accountUpdate_O is not chained to the previous accounts root",
+              error))
+        {
+            return false;
+        }
+        accountsRoot = witness.accountUpdate_O.rootAfter;
+        // Protocol pool: balance B -> balance A, the account is updated at the end of the block
+        if (!check(
+              witness.balanceUpdateB_P.rootBefore == protocolBalancesRoot,
+              "balanceUpdateB_P is not chained to the previous protocol balances root",
+              error) ||
+            !check(
+              witness.balanceUpdateA_P.rootBefore == witness.balanceUpdateB_P.rootAfter,
+              "balanceUpdateA_P is not chained to balanceUpdateB_P",
+              error))
+        {
+            return false;
+        }
+        protocolBalancesRoot = witness.balanceUpdateA_P.rootAfter;
+        return true;
+    }
+
+    bool checkBlockUpdates(const FieldT &accountsRoot, const FieldT &protocolBalancesRoot, std::string &error) const
+    {
+        const AccountUpdate &accountUpdate_P = block.accountUpdate_P;
+        const AccountUpdate &accountUpdate_O = block.accountUpdate_O;
+        for (const Update &update : blockUpdates)
+        {
+            if (!checkRoots(update, error))
+            {
+                return false;
+            }
+        }
+        return check(accountUpdate_P.accountID == FieldT::zero(), "accountUpdate_P: invalid accountID", error) &&
+               check(
+                 accountUpdate_P.rootBefore == accountsRoot,
+                 "accountUpdate_P is not chained to the accounts root of the last transaction",
+                 error) &&
+               check(
+                 accountUpdate_P.after.balancesRoot == protocolBalancesRoot,
+                 "accountUpdate_P is not chained to the protocol balances root of the last transaction",
+                 error) &&
+               check(
+                 accountUpdate_O.accountID == block.operatorAccountID, "accountUpdate_O: invalid accountID", error) &&
+               check(
+                 accountUpdate_O.rootBefore == accountUpdate_P.rootAfter,
+                 "accountUpdate_O is not chained to accountUpdate_P",
+                 error) &&
+               check(accountUpdate_O.rootAfter == block.merkleRootAfter, "merkleRootAfter does not match", error);
+    }
+};
+
+} // namespace Loopring
+
+#endif
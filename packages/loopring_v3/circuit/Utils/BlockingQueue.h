@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2017 Loopring Technology Limited.
+#ifndef _BLOCKINGQUEUE_H_
+#define _BLOCKINGQUEUE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace Loopring
+{
+
+// Simple blocking FIFO used to pass work between threads.
+// When a capacity is given, push blocks while the queue is full.
+template <typename T> class BlockingQueue
+{
+  public:
+    BlockingQueue(size_t _capacity = 0) : capacity(_capacity), closed(false)
+    {
+    }
+
+    void push(const T &value)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            notFull.wait(lock, [this] { return capacity == 0 || values.size() < capacity; });
+            values.push_back(value);
+        }
+        notEmpty.notify_one();
+    }
+
+    // Blocks until a value is available. Returns false when the queue is closed.
+    bool pop(T &value)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            notEmpty.wait(lock, [this] { return closed || !values.empty(); });
+            if (values.empty())
+            {
+                return false;
+            }
+            value = values.front();
+            values.pop_front();
+        }
+        notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mtx);
+            closed = true;
+        }
+        notEmpty.notify_all();
+    }
+
+  private:
+    std::mutex mtx;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<T> values;
+    size_t capacity;
+    bool closed;
+};
+
+} // namespace Loopring
+
+#endif
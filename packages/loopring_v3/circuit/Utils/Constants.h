@@ -3,6 +3,15 @@
 #ifndef _CONSTANTS_H_
 #define _CONSTANTS_H_
 
+#include "ethsnarks.hpp"
+
+// Annotations are only stored in debug builds, but the arguments of FMT are
+// still evaluated. With NO_ANNOTATIONS the annotation strings are not even built.
+#if defined(NO_ANNOTATIONS) && !defined(DEBUG)
+#undef FMT
+#define FMT(...) ""
+#endif
+
 namespace Loopring
 {
 static const unsigned int TREE_DEPTH_STORAGE = 7;
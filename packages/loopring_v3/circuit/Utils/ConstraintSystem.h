@@ -0,0 +1,513 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2017 Loopring Technology Limited.
+#ifndef _CONSTRAINTSYSTEM_H_
+#define _CONSTRAINTSYSTEM_H_
+
+#include "ethsnarks.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace ethsnarks;
+
+namespace Loopring
+{
+
+// Returns the index of the first constraint in [0, numConstraints) for which `isSatisfied`
+// returns false, or numConstraints when all constraints are satisfied.
+// The constraints are checked in chunks by all threads. The chunks are taken in order and no
+// chunk is started after a constraint before it failed, so an invalid witness is rejected early
+// and the result is still the first constraint that fails.
+template <typename F> uint64_t findUnsatisfiedConstraint(uint64_t numConstraints, const F &isSatisfied)
+{
+    const uint64_t chunkSize = 1024;
+    std::atomic<uint64_t> nextChunk(0);
+    std::atomic<uint64_t> firstUnsatisfied(numConstraints);
+#ifdef MULTICORE
+#pragma omp parallel
+#endif
+    {
+        uint64_t begin = nextChunk.fetch_add(chunkSize);
+        while (begin < firstUnsatisfied.load())
+        {
+            const uint64_t end = std::min(begin + chunkSize, numConstraints);
+            for (uint64_t i = begin; i < end; i++)
+            {
+                if (!isSatisfied(i))
+                {
+                    uint64_t current = firstUnsatisfied.load();
+                    while (i < current && !firstUnsatisfied.compare_exchange_weak(current, i))
+                    {
+                    }
+                    break;
+                }
+            }
+            begin = nextChunk.fetch_add(chunkSize);
+        }
+    }
+    return firstUnsatisfied.load();
+}
+
+// Evaluates a linear combination over the values of the protoboard (without the constant ONE)
+static FieldT evaluate(const libsnark::linear_combination<FieldT> &lc, const std::vector<FieldT> &values)
+{
+    FieldT result = FieldT::zero();
+    for (const auto &term : lc.getTerms())
+    {
+        result += (term.index == 0) ? term.getCoeff() : term.getCoeff() * values[term.index - 1];
+    }
+    return result;
+}
+
+// Same as ProtoboardT::is_satisfied, but the constraints are checked in parallel.
+// When given, `unsatisfied` is set to the index of the first constraint that isn't satisfied.
+static bool isSatisfied(const ProtoboardT &pb, uint64_t *unsatisfied = nullptr)
+{
+    const auto &constraints = pb.constraint_system.constraints;
+    const uint64_t index = findUnsatisfiedConstraint(constraints.size(), [&](uint64_t i) {
+        const auto &constraint = *constraints[i];
+        return evaluate(constraint.getA(), pb.values) * evaluate(constraint.getB(), pb.values) ==
+               evaluate(constraint.getC(), pb.values);
+    });
+    if (unsatisfied)
+    {
+        *unsatisfied = index;
+    }
+    return index == constraints.size();
+}
+
+static libsnark::var_index_t getMaxVariable(const libsnark::linear_combination<FieldT> &lc)
+{
+    libsnark::var_index_t variable = 0;
+    for (const auto &term : lc.getTerms())
+    {
+        variable = std::max(variable, term.index);
+    }
+    return variable;
+}
+
+// The highest variable used by constraint `i`. The variables are allocated in the same order as
+// the gadgets, so the variable identifies the gadget the constraint belongs to.
+static libsnark::var_index_t getMaxVariable(const ProtoboardT &pb, uint64_t i)
+{
+    const auto &constraint = *pb.constraint_system.constraints[i];
+    return std::max(
+      {getMaxVariable(constraint.getA()), getMaxVariable(constraint.getB()), getMaxVariable(constraint.getC())});
+}
+
+// The annotation of constraint `i`, only available in debug builds
+static std::string getAnnotation(const ProtoboardT &pb, uint64_t i)
+{
+#ifdef DEBUG
+    const auto &annotations = pb.constraint_system.constraint_annotations;
+    const auto it = annotations.find(i);
+    if (it != annotations.end())
+    {
+        return it->second;
+    }
+#endif
+    return "";
+}
+
+// The R1CS stored in flat arrays (compressed sparse rows) with every unique
+// coefficient stored only once. The layout is the same in memory and on disk,
+// so a cached constraint system can be mapped directly from the file.
+// The prover doesn't use this layout: ethsnarks::prove reads the constraint system of the
+// protoboard, which is rebuilt from the cache with addTo.
+//
+// Layout (all sections 8 byte aligned):
+// - Header
+// - coefficients: numCoefficients field elements in standard (non-Montgomery) form
+// - for A, B and C:
+//   - rowOffsets: numConstraints + 1 uint64_t, terms of constraint i are in [rowOffsets[i], rowOffsets[i + 1])
+//   - variables: numTerms uint32_t
+//   - coefficients: numTerms uint32_t, indices in the coefficients table
+class FlatConstraintSystem
+{
+  public:
+    static const uint64_t MAGIC = 0x5343314353524c4cULL;
+    static const uint32_t VERSION = 2;
+
+    struct Header
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t coefficientSize;
+        uint64_t numVariables;
+        uint64_t numInputs;
+        uint64_t numConstraints;
+        uint64_t numCoefficients;
+        uint64_t numTerms[3];
+        // Hash of the complete proving key the constraint system was cached for
+        uint64_t keyFingerprint;
+        // Hash of everything else in the file
+        uint64_t fingerprint;
+    };
+
+    struct Matrix
+    {
+        const uint64_t *rowOffsets;
+        const uint32_t *variables;
+        const uint32_t *coefficients;
+    };
+
+    FlatConstraintSystem() : header(nullptr), mapping(nullptr), mappingSize(0)
+    {
+    }
+
+    ~FlatConstraintSystem()
+    {
+        unmap();
+    }
+
+    FlatConstraintSystem(const FlatConstraintSystem &) = delete;
+    FlatConstraintSystem &operator=(const FlatConstraintSystem &) = delete;
+
+    // Flattens the constraints currently on the protoboard
+    void build(const ProtoboardT &pb, uint64_t keyFingerprint)
+    {
+        unmap();
+        const auto &constraints = pb.constraint_system.constraints;
+
+        // Intern the coefficients
+        std::vector<std::string> uniqueCoefficients;
+        std::unordered_map<std::string, uint32_t> coefficientIndices;
+        std::vector<uint64_t> rowOffsets[3];
+        std::vector<uint32_t> variables[3];
+        std::vector<uint32_t> termCoefficients[3];
+        for (unsigned int m = 0; m < 3; m++)
+        {
+            rowOffsets[m].reserve(constraints.size() + 1);
+            rowOffsets[m].push_back(0);
+        }
+        for (size_t i = 0; i < constraints.size(); i++)
+        {
+            for (unsigned int m = 0; m < 3; m++)
+            {
+                const auto &lc = (m == 0) ? constraints[i]->getA()
+                                          : ((m == 1) ? constraints[i]->getB() : constraints[i]->getC());
+                for (const auto &term : lc.getTerms())
+                {
+                    const auto coefficient = term.getCoeff().as_bigint();
+                    std::string key((const char *)coefficient.data, sizeof(coefficient.data));
+                    auto it = coefficientIndices.find(key);
+                    if (it == coefficientIndices.end())
+                    {
+                        it = coefficientIndices.emplace(key, uint32_t(uniqueCoefficients.size())).first;
+                        uniqueCoefficients.push_back(key);
+                    }
+                    variables[m].push_back(uint32_t(term.index));
+                    termCoefficients[m].push_back(it->second);
+                }
+                rowOffsets[m].push_back(variables[m].size());
+            }
+        }
+
+        // Write everything in a single buffer
+        Header h;
+        memset(&h, 0, sizeof(h));
+        h.magic = MAGIC;
+        h.version = VERSION;
+        h.coefficientSize = uniqueCoefficients.empty() ? getCoefficientSize() : uniqueCoefficients[0].size();
+        h.numVariables = pb.num_variables();
+        h.numInputs = pb.num_inputs();
+        h.numConstraints = constraints.size();
+        h.numCoefficients = uniqueCoefficients.size();
+        for (unsigned int m = 0; m < 3; m++)
+        {
+            h.numTerms[m] = variables[m].size();
+        }
+        h.keyFingerprint = keyFingerprint;
+
+        storage.assign(getSize(h) / sizeof(uint64_t), 0);
+        char *data = (char *)storage.data();
+        memcpy(data, &h, sizeof(h));
+        size_t offset = sizeof(Header);
+        for (const std::string &coefficient : uniqueCoefficients)
+        {
+            memcpy(data + offset, coefficient.data(), coefficient.size());
+            offset += coefficient.size();
+        }
+        offset = align(offset);
+        for (unsigned int m = 0; m < 3; m++)
+        {
+            offset = copy(data, offset, rowOffsets[m]);
+            offset = copy(data, offset, variables[m]);
+            offset = copy(data, offset, termCoefficients[m]);
+        }
+        ((Header *)data)->fingerprint = hash(data, storage.size() * sizeof(uint64_t), FINGERPRINT_WORD);
+        setup(data);
+    }
+
+    // Maps a cached constraint system. Returns false when the file is missing or invalid.
+    bool load(const std::string &filename)
+    {
+        unmap();
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header))
+        {
+            close(fd);
+            return false;
+        }
+        void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED)
+        {
+            return false;
+        }
+        mapping = ptr;
+        mappingSize = st.st_size;
+
+        const char *data = (const char *)mapping;
+        const Header &h = *(const Header *)data;
+        if (h.magic != MAGIC || h.version != VERSION || h.coefficientSize != getCoefficientSize() ||
+            getSize(h) != mappingSize || hash(data, mappingSize, FINGERPRINT_WORD) != h.fingerprint)
+        {
+            std::cerr << "Invalid constraint system cache: " << filename << std::endl;
+            unmap();
+            return false;
+        }
+        setup(data);
+        return true;
+    }
+
+    bool write(const std::string &filename) const
+    {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        file.write((const char *)header, getSize(*header));
+        return file.good();
+    }
+
+    // Adds the constraints to the protoboard. The variables have to be allocated already.
+    void addTo(ProtoboardT &pb) const
+    {
+        pb.constraint_system.constraints.reserve(pb.constraint_system.constraints.size() + header->numConstraints);
+        for (uint64_t i = 0; i < header->numConstraints; i++)
+        {
+            libsnark::linear_combination<FieldT> lcs[3];
+            for (unsigned int m = 0; m < 3; m++)
+            {
+                const Matrix &matrix = matrices[m];
+                for (uint64_t t = matrix.rowOffsets[i]; t < matrix.rowOffsets[i + 1]; t++)
+                {
+                    lcs[m].add_term(
+                      libsnark::variable<FieldT>(matrix.variables[t]), coefficients[matrix.coefficients[t]]);
+                }
+            }
+            pb.add_r1cs_constraint(ConstraintT(lcs[0], lcs[1], lcs[2]), "");
+        }
+    }
+
+    // Evaluates row `i` of matrix `m` over the values of the protoboard (without the constant ONE)
+    FieldT evaluate(unsigned int m, uint64_t i, const std::vector<FieldT> &values) const
+    {
+        const Matrix &matrix = matrices[m];
+        FieldT result = FieldT::zero();
+        for (uint64_t t = matrix.rowOffsets[i]; t < matrix.rowOffsets[i + 1]; t++)
+        {
+            const uint32_t variable = matrix.variables[t];
+            const FieldT &coefficient = coefficients[matrix.coefficients[t]];
+            result += (variable == 0) ? coefficient : coefficient * values[variable - 1];
+        }
+        return result;
+    }
+
+    // Same as ProtoboardT::is_satisfied, but reads the constraints from the flat layout and
+    // checks them in parallel. When given, `unsatisfied` is set to the index of the first
+    // constraint that isn't satisfied (numConstraints when the variables don't match).
+    bool isSatisfied(const ProtoboardT &pb, uint64_t *unsatisfied = nullptr) const
+    {
+        uint64_t index = header->numConstraints;
+        bool satisfied = false;
+        if (pb.num_variables() == header->numVariables && pb.num_inputs() == header->numInputs)
+        {
+            index = findUnsatisfiedConstraint(header->numConstraints, [&](uint64_t i) {
+                return evaluate(0, i, pb.values) * evaluate(1, i, pb.values) == evaluate(2, i, pb.values);
+            });
+            satisfied = (index == header->numConstraints);
+        }
+        if (unsatisfied)
+        {
+            *unsatisfied = index;
+        }
+        return satisfied;
+    }
+
+    // The highest variable used by constraint `i`
+    libsnark::var_index_t getMaxVariable(uint64_t i) const
+    {
+        libsnark::var_index_t variable = 0;
+        for (unsigned int m = 0; m < 3; m++)
+        {
+            const Matrix &matrix = matrices[m];
+            for (uint64_t t = matrix.rowOffsets[i]; t < matrix.rowOffsets[i + 1]; t++)
+            {
+                variable = std::max<libsnark::var_index_t>(variable, matrix.variables[t]);
+            }
+        }
+        return variable;
+    }
+
+    const Header &getHeader() const
+    {
+        return *header;
+    }
+
+    const Matrix &getMatrix(unsigned int m) const
+    {
+        return matrices[m];
+    }
+
+    bool isLoaded() const
+    {
+        return header != nullptr;
+    }
+
+    void clear()
+    {
+        unmap();
+    }
+
+    // Hash of the size and the complete contents of a file, read in chunks
+    static uint64_t hashFile(const std::string &filename)
+    {
+        const size_t chunkSize = 1024 * 1024;
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+        {
+            return 0;
+        }
+        const uint64_t size = file.tellg();
+        uint64_t h = hash(&size, sizeof(size));
+        std::vector<uint64_t> buffer(chunkSize / sizeof(uint64_t));
+        file.seekg(0);
+        for (uint64_t offset = 0; offset < size; offset += chunkSize)
+        {
+            const size_t length = std::min<uint64_t>(size - offset, chunkSize);
+            // The last chunk is padded with zeros to a whole number of words
+            std::fill(buffer.begin(), buffer.end(), 0);
+            if (!file.read((char *)buffer.data(), length))
+            {
+                return 0;
+            }
+            h = hash(buffer.data(), align(length), size_t(-1), h);
+        }
+        return h;
+    }
+
+  private:
+    // The fingerprint itself is not included in the fingerprint
+    static const size_t FINGERPRINT_WORD = offsetof(Header, fingerprint) / sizeof(uint64_t);
+
+    const Header *header;
+    Matrix matrices[3];
+    // Either the data is owned or mapped from a file
+    std::vector<uint64_t> storage;
+    void *mapping;
+    size_t mappingSize;
+    // The coefficients table as field elements
+    std::vector<FieldT> coefficients;
+
+    static size_t getCoefficientSize()
+    {
+        return sizeof(libff::bigint<FieldT::num_limbs>::data);
+    }
+
+    static size_t align(size_t offset)
+    {
+        return (offset + 7) & ~size_t(7);
+    }
+
+    static size_t getSize(const Header &h)
+    {
+        size_t size = align(sizeof(Header) + h.numCoefficients * h.coefficientSize);
+        for (unsigned int m = 0; m < 3; m++)
+        {
+            size += (h.numConstraints + 1) * sizeof(uint64_t);
+            size += align(h.numTerms[m] * sizeof(uint32_t));
+            size += align(h.numTerms[m] * sizeof(uint32_t));
+        }
+        return size;
+    }
+
+    template <typename T> static size_t copy(char *data, size_t offset, const std::vector<T> &values)
+    {
+        memcpy(data + offset, values.data(), values.size() * sizeof(T));
+        return align(offset + values.size() * sizeof(T));
+    }
+
+    // FNV-1a over 64-bit words, continues from `h`
+    static uint64_t hash(const void *data, size_t size, size_t skip = size_t(-1), uint64_t h = 0xcbf29ce484222325ULL)
+    {
+        const uint64_t *words = (const uint64_t *)data;
+        for (size_t i = 0; i < size / sizeof(uint64_t); i++)
+        {
+            if (i != skip)
+            {
+                h ^= words[i];
+                h *= 0x100000001b3ULL;
+            }
+        }
+        return h;
+    }
+
+    void setup(const char *data)
+    {
+        header = (const Header *)data;
+        size_t offset = align(sizeof(Header) + header->numCoefficients * header->coefficientSize);
+        for (unsigned int m = 0; m < 3; m++)
+        {
+            matrices[m].rowOffsets = (const uint64_t *)(data + offset);
+            offset += (header->numConstraints + 1) * sizeof(uint64_t);
+            matrices[m].variables = (const uint32_t *)(data + offset);
+            offset += align(header->numTerms[m] * sizeof(uint32_t));
+            matrices[m].coefficients = (const uint32_t *)(data + offset);
+            offset += align(header->numTerms[m] * sizeof(uint32_t));
+        }
+
+        coefficients.clear();
+        coefficients.reserve(header->numCoefficients);
+        for (uint64_t i = 0; i < header->numCoefficients; i++)
+        {
+            libff::bigint<FieldT::num_limbs> coefficient;
+            memcpy(coefficient.data, data + sizeof(Header) + i * header->coefficientSize, header->coefficientSize);
+            coefficients.emplace_back(coefficient);
+        }
+    }
+
+    void unmap()
+    {
+        if (mapping)
+        {
+            munmap(mapping, mappingSize);
+            mapping = nullptr;
+            mappingSize = 0;
+        }
+        storage.clear();
+        coefficients.clear();
+        header = nullptr;
+    }
+};
+
+} // namespace Loopring
+
+#endif
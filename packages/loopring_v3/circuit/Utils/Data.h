@@ -10,6 +10,14 @@
 #include "jubjub/eddsa.hpp"
 #include "jubjub/point.hpp"
 
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 using json = nlohmann::json;
 
 namespace Loopring
@@ -174,20 +182,130 @@ enum class TransactionType
     COUNT
 };
 
+// The hashes of a Merkle proof. Most of the hashes are the same in all proofs of a block
+// (e.g. the hashes of the empty subtrees), so the values are stored in a table shared by
+// the proofs and a proof only points to its values.
 class Proof
 {
   public:
-    std::vector<ethsnarks::FieldT> data;
+    // Keeps the values alive
+    std::shared_ptr<const std::deque<ethsnarks::FieldT>> table;
+    std::vector<const ethsnarks::FieldT *> values;
+
+    Proof()
+    {
+    }
+
+    // A proof with its own table
+    Proof(const std::vector<ethsnarks::FieldT> &_values)
+        : table(std::make_shared<const std::deque<ethsnarks::FieldT>>(_values.begin(), _values.end()))
+    {
+        for (const ethsnarks::FieldT &value : *table)
+        {
+            values.push_back(&value);
+        }
+    }
+
+    size_t size() const
+    {
+        return values.size();
+    }
+
+    const ethsnarks::FieldT &operator[](size_t i) const
+    {
+        return *values[i];
+    }
+
+    std::vector<ethsnarks::FieldT> getValues() const
+    {
+        std::vector<ethsnarks::FieldT> result;
+        result.reserve(values.size());
+        for (const ethsnarks::FieldT *value : values)
+        {
+            result.push_back(*value);
+        }
+        return result;
+    }
+
+    // Changes a value of this proof only
+    void set(size_t i, const ethsnarks::FieldT &value)
+    {
+        std::vector<ethsnarks::FieldT> newValues = getValues();
+        newValues[i] = value;
+        *this = Proof(newValues);
+    }
 };
 
 static void from_json(const json &j, Proof &proof)
 {
+    std::vector<ethsnarks::FieldT> values;
     for (unsigned int i = 0; i < j.size(); i++)
     {
-        proof.data.push_back(ethsnarks::FieldT(j[i].get<std::string>().c_str()));
+        values.push_back(ethsnarks::FieldT(j[i].get<std::string>().c_str()));
     }
+    proof = Proof(values);
 }
 
+// Builds a table with every distinct proof value only once.
+// The values never move while the table grows, so proofs can already be used
+// (e.g. on other threads) while more values are added.
+class ProofTable
+{
+  public:
+    std::shared_ptr<std::deque<ethsnarks::FieldT>> values;
+
+    ProofTable() : values(std::make_shared<std::deque<ethsnarks::FieldT>>())
+    {
+    }
+
+    size_t size() const
+    {
+        return values->size();
+    }
+
+    const ethsnarks::FieldT *get(uint32_t index) const
+    {
+        return &(*values)[index];
+    }
+
+    uint32_t intern(const ethsnarks::FieldT &value)
+    {
+        const auto bigint = value.as_bigint();
+        std::string key((const char *)bigint.data, sizeof(bigint.data));
+        auto it = indices.find(key);
+        if (it != indices.end())
+        {
+            return it->second;
+        }
+        values->push_back(value);
+        indices.emplace(key, values->size() - 1);
+        return values->size() - 1;
+    }
+
+    // Adds a value that is set later (e.g. converted on another thread). The value is not
+    // deduplicated.
+    ethsnarks::FieldT *reserve()
+    {
+        values->emplace_back();
+        return &values->back();
+    }
+
+    // Moves the values of the proof to this table
+    void intern(Proof &proof)
+    {
+        std::vector<const ethsnarks::FieldT *> proofValues(proof.size());
+        for (unsigned int i = 0; i < proof.size(); i++)
+        {
+            proofValues[i] = get(intern(proof[i]));
+        }
+        proof.table = values;
+        proof.values = std::move(proofValues);
+    }
+
+  private:
+    std::unordered_map<std::string, uint32_t> indices;
+};
+
 class StorageLeaf
 {
   public:
@@ -595,6 +713,41 @@ static void from_json(const json &j, NftData &nftMint)
     nftMint.creatorFeeBips = ethsnarks::FieldT(j.at("creatorFeeBips"));
 }
 
+// The dummy data, decoded only once and shared by all transactions
+class DummyData
+{
+  public:
+    Signature signature;
+    SpotTrade spotTrade;
+    Transfer transfer;
+    Withdrawal withdraw;
+    Deposit deposit;
+    AccountUpdateTx accountUpdate;
+    AmmUpdate ammUpdate;
+    SignatureVerification signatureVerification;
+    NftMint nftMint;
+    NftData nftData;
+};
+
+static const DummyData &getDummyData()
+{
+    static const DummyData dummyData = []() {
+        DummyData data;
+        data.signature = dummySignature.get<Signature>();
+        data.spotTrade = dummySpotTrade.get<SpotTrade>();
+        data.transfer = dummyTransfer.get<Transfer>();
+        data.withdraw = dummyWithdraw.get<Withdrawal>();
+        data.deposit = dummyDeposit.get<Deposit>();
+        data.accountUpdate = dummyAccountUpdate.get<AccountUpdateTx>();
+        data.ammUpdate = dummyAmmUpdate.get<AmmUpdate>();
+        data.signatureVerification = dummySignatureVerification.get<SignatureVerification>();
+        data.nftMint = dummyNftMint.get<NftMint>();
+        data.nftData = dummyNftData.get<NftData>();
+        return data;
+    }();
+    return dummyData;
+}
+
 class Witness
 {
   public:
@@ -642,8 +795,8 @@ static void from_json(const json &j, Witness &state)
     state.balanceUpdateA_P = j.at("balanceUpdateA_P").get<BalanceUpdate>();
     state.balanceUpdateB_P = j.at("balanceUpdateB_P").get<BalanceUpdate>();
 
-    state.signatureA = dummySignature.get<Signature>();
-    state.signatureB = dummySignature.get<Signature>();
+    state.signatureA = getDummyData().signature;
+    state.signatureB = getDummyData().signature;
 
     state.numConditionalTransactionsAfter = ethsnarks::FieldT(j.at("numConditionalTransactionsAfter"));
 
@@ -666,41 +819,88 @@ class UniversalTransaction
   public:
     Witness witness;
     ethsnarks::FieldT type;
-    SpotTrade spotTrade;
-    Transfer transfer;
-    Withdrawal withdraw;
-    Deposit deposit;
-    AccountUpdateTx accountUpdate;
-    AmmUpdate ammUpdate;
-    SignatureVerification signatureVerification;
-    NftMint nftMint;
-    NftData nftData;
+    // Only the data of the actual transaction type is stored, the gadgets of all
+    // other transaction types use the dummy data
+    std::shared_ptr<const SpotTrade> spotTrade;
+    std::shared_ptr<const Transfer> transfer;
+    std::shared_ptr<const Withdrawal> withdraw;
+    std::shared_ptr<const Deposit> deposit;
+    std::shared_ptr<const AccountUpdateTx> accountUpdate;
+    std::shared_ptr<const AmmUpdate> ammUpdate;
+    std::shared_ptr<const SignatureVerification> signatureVerification;
+    std::shared_ptr<const NftMint> nftMint;
+    std::shared_ptr<const NftData> nftData;
+
+    const SpotTrade &getSpotTrade() const
+    {
+        return spotTrade ? *spotTrade : getDummyData().spotTrade;
+    }
+
+    // Some of the dummy tx's are patched so they are valid against the current state
+    Transfer getTransfer() const
+    {
+        if (transfer)
+        {
+            return *transfer;
+        }
+        Transfer dummy = getDummyData().transfer;
+        dummy.to = witness.accountUpdate_B.before.owner;
+        dummy.payerTo = witness.accountUpdate_B.before.owner;
+        return dummy;
+    }
+
+    const Withdrawal &getWithdraw() const
+    {
+        return withdraw ? *withdraw : getDummyData().withdraw;
+    }
+
+    Deposit getDeposit() const
+    {
+        if (deposit)
+        {
+            return *deposit;
+        }
+        Deposit dummy = getDummyData().deposit;
+        dummy.owner = witness.accountUpdate_A.before.owner;
+        return dummy;
+    }
+
+    AccountUpdateTx getAccountUpdate() const
+    {
+        if (accountUpdate)
+        {
+            return *accountUpdate;
+        }
+        AccountUpdateTx dummy = getDummyData().accountUpdate;
+        dummy.owner = witness.accountUpdate_A.before.owner;
+        return dummy;
+    }
+
+    const AmmUpdate &getAmmUpdate() const
+    {
+        return ammUpdate ? *ammUpdate : getDummyData().ammUpdate;
+    }
+
+    const SignatureVerification &getSignatureVerification() const
+    {
+        return signatureVerification ? *signatureVerification : getDummyData().signatureVerification;
+    }
+
+    const NftMint &getNftMint() const
+    {
+        return nftMint ? *nftMint : getDummyData().nftMint;
+    }
+
+    const NftData &getNftData() const
+    {
+        return nftData ? *nftData : getDummyData().nftData;
+    }
 };
 
 static void from_json(const json &j, UniversalTransaction &transaction)
 {
     transaction.witness = j.at("witness").get<Witness>();
 
-    // Fill in dummy data for all tx types
-    transaction.spotTrade = dummySpotTrade.get<Loopring::SpotTrade>();
-    transaction.transfer = dummyTransfer.get<Loopring::Transfer>();
-    transaction.withdraw = dummyWithdraw.get<Loopring::Withdrawal>();
-    transaction.deposit = dummyDeposit.get<Loopring::Deposit>();
-    transaction.accountUpdate = dummyAccountUpdate.get<Loopring::AccountUpdateTx>();
-    transaction.ammUpdate = dummyAmmUpdate.get<Loopring::AmmUpdate>();
-    transaction.signatureVerification = dummySignatureVerification.get<Loopring::SignatureVerification>();
-    transaction.nftMint = dummyNftMint.get<Loopring::NftMint>();
-    transaction.nftData = dummyNftData.get<Loopring::NftData>();
-
-    // Patch some of the dummy tx's so they are valid against the current state
-    // Deposit
-    transaction.deposit.owner = transaction.witness.accountUpdate_A.before.owner;
-    // AccountUpdate
-    transaction.accountUpdate.owner = transaction.witness.accountUpdate_A.before.owner;
-    // Transfer
-    transaction.transfer.to = transaction.witness.accountUpdate_B.before.owner;
-    transaction.transfer.payerTo = transaction.witness.accountUpdate_B.before.owner;
-
     // Now get the actual transaction data for the actual transaction that will
     // execute from the block
     if (j.contains("noop"))
@@ -710,47 +910,49 @@ static void from_json(const json &j, UniversalTransaction &transaction)
     if (j.contains("spotTrade"))
     {
         transaction.type = ethsnarks::FieldT(int(Loopring::TransactionType::SpotTrade));
-        transaction.spotTrade = j.at("spotTrade").get<Loopring::SpotTrade>();
+        transaction.spotTrade = std::make_shared<const SpotTrade>(j.at("spotTrade").get<Loopring::SpotTrade>());
     }
     else if (j.contains("transfer"))
     {
         transaction.type = ethsnarks::FieldT(int(Loopring::TransactionType::Transfer));
-        transaction.transfer = j.at("transfer").get<Loopring::Transfer>();
+        transaction.transfer = std::make_shared<const Transfer>(j.at("transfer").get<Loopring::Transfer>());
     }
     else if (j.contains("withdraw"))
     {
         transaction.type = ethsnarks::FieldT(int(Loopring::TransactionType::Withdrawal));
-        transaction.withdraw = j.at("withdraw").get<Loopring::Withdrawal>();
+        transaction.withdraw = std::make_shared<const Withdrawal>(j.at("withdraw").get<Loopring::Withdrawal>());
     }
     else if (j.contains("deposit"))
     {
         transaction.type = ethsnarks::FieldT(int(Loopring::TransactionType::Deposit));
-        transaction.deposit = j.at("deposit").get<Loopring::Deposit>();
+        transaction.deposit = std::make_shared<const Deposit>(j.at("deposit").get<Loopring::Deposit>());
     }
     else if (j.contains("accountUpdate"))
     {
         transaction.type = ethsnarks::FieldT(int(Loopring::TransactionType::AccountUpdate));
-        transaction.accountUpdate = j.at("accountUpdate").get<Loopring::AccountUpdateTx>();
+        transaction.accountUpdate =
+          std::make_shared<const AccountUpdateTx>(j.at("accountUpdate").get<Loopring::AccountUpdateTx>());
     }
     else if (j.contains("ammUpdate"))
     {
         transaction.type = ethsnarks::FieldT(int(Loopring::TransactionType::AmmUpdate));
-        transaction.ammUpdate = j.at("ammUpdate").get<Loopring::AmmUpdate>();
+        transaction.ammUpdate = std::make_shared<const AmmUpdate>(j.at("ammUpdate").get<Loopring::AmmUpdate>());
     }
     else if (j.contains("signatureVerification"))
     {
         transaction.type = ethsnarks::FieldT(int(Loopring::TransactionType::SignatureVerification));
-        transaction.signatureVerification = j.at("signatureVerification").get<Loopring::SignatureVerification>();
+        transaction.signatureVerification = std::make_shared<const SignatureVerification>(
+          j.at("signatureVerification").get<Loopring::SignatureVerification>());
     }
     else if (j.contains("nftMint"))
     {
         transaction.type = ethsnarks::FieldT(int(Loopring::TransactionType::NftMint));
-        transaction.nftMint = j.at("nftMint").get<Loopring::NftMint>();
+        transaction.nftMint = std::make_shared<const NftMint>(j.at("nftMint").get<Loopring::NftMint>());
     }
     else if (j.contains("nftData"))
     {
         transaction.type = ethsnarks::FieldT(int(Loopring::TransactionType::NftData));
-        transaction.nftData = j.at("nftData").get<Loopring::NftData>();
+        transaction.nftData = std::make_shared<const NftData>(j.at("nftData").get<Loopring::NftData>());
     }
 }
 
@@ -796,11 +998,58 @@ static void from_json(const json &j, Block &block)
     block.operatorAccountID = ethsnarks::FieldT(j.at("operatorAccountID"));
     block.accountUpdate_O = j.at("accountUpdate_O").get<AccountUpdate>();
 
-    // Read transactions
-    json jTransactions = j["transactions"];
-    for (unsigned int i = 0; i < jTransactions.size(); i++)
+    // Read transactions, every transaction is decoded independently
+    const json &jTransactions = j.at("transactions");
+    const int numTransactions = jTransactions.size();
+    block.transactions.resize(numTransactions);
+    std::vector<std::string> errors(numTransactions);
+#ifdef MULTICORE
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < numTransactions; i++)
+    {
+        try
+        {
+            from_json(jTransactions[i], block.transactions[i]);
+        }
+        catch (const std::exception &e)
+        {
+            errors[i] = e.what();
+        }
+    }
+
+    std::string error;
+    for (int i = 0; i < numTransactions; i++)
+    {
+        if (!errors[i].empty())
+        {
+            error += "transaction " + std::to_string(i) + ": " + errors[i] + "\n";
+        }
+    }
+    if (!error.empty())
+    {
+        throw std::invalid_argument("Invalid block:\n" + error);
+    }
+    // Share the proof values between all transactions
+    ProofTable proofTable;
+    proofTable.intern(block.accountUpdate_P.proof);
+    proofTable.intern(block.accountUpdate_O.proof);
+    for (UniversalTransaction &transaction : block.transactions)
     {
-        block.transactions.emplace_back(jTransactions[i].get<Loopring::UniversalTransaction>());
+        Witness &witness = transaction.witness;
+        proofTable.intern(witness.storageUpdate_A.proof);
+        proofTable.intern(witness.storageUpdate_B.proof);
+        proofTable.intern(witness.balanceUpdateS_A.proof);
+        proofTable.intern(witness.balanceUpdateB_A.proof);
+        proofTable.intern(witness.accountUpdate_A.proof);
+        proofTable.intern(witness.balanceUpdateS_B.proof);
+        proofTable.intern(witness.balanceUpdateB_B.proof);
+        proofTable.intern(witness.accountUpdate_B.proof);
+        proofTable.intern(witness.balanceUpdateA_O.proof);
+        proofTable.intern(witness.balanceUpdateB_O.proof);
+        proofTable.intern(witness.accountUpdate_O.proof);
+        proofTable.intern(witness.balanceUpdateA_P.proof);
+        proofTable.intern(witness.balanceUpdateB_P.proof);
     }
 }
 
@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2017 Loopring Technology Limited.
+#ifndef _NATIVEMERKLETREE_H_
+#define _NATIVEMERKLETREE_H_
+
+#include "Constants.h"
+#include "Data.h"
+#include "Poseidon.h"
+
+#include "ethsnarks.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+using namespace ethsnarks;
+
+namespace Loopring
+{
+
+// The leaf hashes, same as HashAccountLeaf, HashBalanceLeaf and HashStorageLeaf in MerkleTree.h
+
+static FieldT hashLeaf(const AccountLeaf &leaf)
+{
+    return NativePoseidon_6::hash(
+      {leaf.owner, leaf.publicKey.x, leaf.publicKey.y, leaf.nonce, leaf.feeBipsAMM, leaf.balancesRoot});
+}
+
+static FieldT hashLeaf(const BalanceLeaf &leaf)
+{
+    return NativePoseidon_4::hash({leaf.balance, leaf.weightAMM, leaf.storageRoot});
+}
+
+static FieldT hashLeaf(const StorageLeaf &leaf)
+{
+    return NativePoseidon_4::hash({leaf.data, leaf.storageID});
+}
+
+// The position of a leaf in a tree (the lowest 64 bits of the field element)
+static uint64_t toAddress(const FieldT &value)
+{
+    return value.as_bigint().data[0];
+}
+
+// Computes the roots of many Merkle paths of the same depth, the same as merkle_path_compute_4
+// does for a single path. All paths are hashed up one level at a time, so all hashes of a
+// level are permuted together.
+class MerkleRootBatch
+{
+  public:
+    MerkleRootBatch(unsigned int _depth) : depth(_depth)
+    {
+    }
+
+    // Adds the path of `leaf` at `address`. The proof needs to stay alive until the roots
+    // are computed. Returns the index of the root.
+    size_t add(const FieldT &leaf, uint64_t address, const Proof &proof)
+    {
+        assert(proof.size() == depth * 3);
+        paths.push_back({address, &proof});
+        nodes.push_back(leaf);
+        return nodes.size() - 1;
+    }
+
+    size_t size() const
+    {
+        return nodes.size();
+    }
+
+    // Computes the roots of all paths, only call this once. The paths are independent, so
+    // they are split in chunks that are hashed up in parallel.
+    void compute()
+    {
+        const size_t chunkSize = 1024;
+        const int numChunks = (nodes.size() + chunkSize - 1) / chunkSize;
+#ifdef MULTICORE
+#pragma omp parallel for
+#endif
+        for (int chunk = 0; chunk < numChunks; chunk++)
+        {
+            const size_t begin = chunk * chunkSize;
+            compute(begin, std::min(begin + chunkSize, nodes.size()));
+        }
+    }
+
+    // Only valid after compute()
+    const FieldT &getRoot(size_t index) const
+    {
+        return nodes[index];
+    }
+
+  private:
+    void compute(size_t begin, size_t end)
+    {
+        std::vector<NativePoseidon_4::State> states(end - begin);
+        for (unsigned int level = 0; level < depth; level++)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const unsigned int position = (paths[i].address >> (level * 2)) & 3;
+                const Proof &proof = *paths[i].proof;
+                NativePoseidon_4::State &state = states[i - begin];
+                for (unsigned int c = 0, s = level * 3; c < 4; c++)
+                {
+                    state[c] = (c == position) ? nodes[i] : proof[s++];
+                }
+                state[4] = FieldT::zero();
+            }
+            NativePoseidon_4::permute(states.data(), states.size());
+            for (size_t i = begin; i < end; i++)
+            {
+                nodes[i] = states[i - begin][0];
+            }
+        }
+    }
+
+    struct Path
+    {
+        uint64_t address;
+        const Proof *proof;
+    };
+
+    const unsigned int depth;
+    std::vector<Path> paths;
+    std::vector<FieldT> nodes;
+};
+
+} // namespace Loopring
+
+#endif
@@ -0,0 +1,356 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2017 Loopring Technology Limited.
+#ifndef _POSEIDON_H_
+#define _POSEIDON_H_
+
+#include "ethsnarks.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace ethsnarks;
+
+namespace Loopring
+{
+
+// BLAKE2b with a 32 byte digest and without a key (RFC 7693).
+// Only used to derive the Poseidon constants.
+class Blake2b
+{
+  public:
+    static void hash256(const uint8_t *data, size_t length, uint8_t *digest)
+    {
+        uint64_t h[8];
+        std::copy(getIV(), getIV() + 8, h);
+        // Parameter block: digest length 32, no key, fanout 1, depth 1
+        h[0] ^= 0x01010000 ^ 32;
+
+        uint64_t counter = 0;
+        size_t offset = 0;
+        while (length - offset > 128)
+        {
+            counter += 128;
+            compress(h, data + offset, counter, false);
+            offset += 128;
+        }
+        uint8_t block[128] = {};
+        std::memcpy(block, data + offset, length - offset);
+        counter += length - offset;
+        compress(h, block, counter, true);
+
+        for (unsigned int i = 0; i < 32; i++)
+        {
+            digest[i] = uint8_t(h[i / 8] >> (8 * (i % 8)));
+        }
+    }
+
+  private:
+    static const uint64_t *getIV()
+    {
+        static const uint64_t IV[8] = {
+          0x6a09e667f3bcc908,
+          0xbb67ae8584caa73b,
+          0x3c6ef372fe94f82b,
+          0xa54ff53a5f1d36f1,
+          0x510e527fade682d1,
+          0x9b05688c2b3e6c1f,
+          0x1f83d9abfb41bd6b,
+          0x5be0cd19137e2179};
+        return IV;
+    }
+
+    static uint64_t rotr(uint64_t x, unsigned int n)
+    {
+        return (x >> n) | (x << (64 - n));
+    }
+
+    static void mix(uint64_t *v, unsigned int a, unsigned int b, unsigned int c, unsigned int d, uint64_t x, uint64_t y)
+    {
+        v[a] = v[a] + v[b] + x;
+        v[d] = rotr(v[d] ^ v[a], 32);
+        v[c] = v[c] + v[d];
+        v[b] = rotr(v[b] ^ v[c], 24);
+        v[a] = v[a] + v[b] + y;
+        v[d] = rotr(v[d] ^ v[a], 16);
+        v[c] = v[c] + v[d];
+        v[b] = rotr(v[b] ^ v[c], 63);
+    }
+
+    static void compress(uint64_t *h, const uint8_t *block, uint64_t counter, bool last)
+    {
+        static const uint8_t sigma[12][16] = {
+          {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+          {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+          {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+          {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+          {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+          {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+          {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+          {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+          {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+          {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+          {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+          {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3}};
+
+        uint64_t m[16];
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            m[i] = 0;
+            for (unsigned int j = 0; j < 8; j++)
+            {
+                m[i] |= uint64_t(block[i * 8 + j]) << (8 * j);
+            }
+        }
+        const uint64_t *IV = getIV();
+        uint64_t v[16];
+        for (unsigned int i = 0; i < 8; i++)
+        {
+            v[i] = h[i];
+            v[i + 8] = IV[i];
+        }
+        v[12] ^= counter;
+        if (last)
+        {
+            v[14] = ~v[14];
+        }
+        for (unsigned int r = 0; r < 12; r++)
+        {
+            const uint8_t *s = sigma[r];
+            mix(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+            mix(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+            mix(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+            mix(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+            mix(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+            mix(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+            mix(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+            mix(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+        }
+        for (unsigned int i = 0; i < 8; i++)
+        {
+            h[i] ^= v[i] ^ v[i + 8];
+        }
+    }
+};
+
+// The constants of a Poseidon permutation, derived exactly like ethsnarks does for
+// Poseidon_gadget_T (seed "poseidon", e = 5):
+// - C[i] = H^(i+1)("poseidon_constants") mod p
+// - M[i][j] = 1 / (c[i] - c[t + j]) with c[k] = H^(k+1)("poseidon_matrix_0000") mod p
+// where H is BLAKE2b-256, with its output as a little endian number.
+class PoseidonParams
+{
+  public:
+    const unsigned int t;
+    const unsigned int nRoundsF;
+    const unsigned int nRoundsP;
+    std::vector<FieldT> C;
+    // t * t, row by row
+    std::vector<FieldT> M;
+
+    PoseidonParams(unsigned int _t, unsigned int _nRoundsF, unsigned int _nRoundsP)
+        : t(_t),
+          nRoundsF(_nRoundsF),
+          nRoundsP(_nRoundsP),
+          C(deriveConstants("poseidon_constants", nRoundsF + nRoundsP))
+    {
+        std::vector<FieldT> c = deriveConstants("poseidon_matrix_0000", t * 2);
+        M.reserve(t * t);
+        for (unsigned int i = 0; i < t; i++)
+        {
+            for (unsigned int j = 0; j < t; j++)
+            {
+                M.push_back((c[i] - c[t + j]).inverse());
+            }
+        }
+    }
+
+  private:
+    static std::vector<FieldT> deriveConstants(const std::string &seed, unsigned int n)
+    {
+        std::vector<FieldT> constants;
+        constants.reserve(n);
+        uint8_t digest[32];
+        Blake2b::hash256((const uint8_t *)seed.data(), seed.size(), digest);
+        for (unsigned int i = 0; i < n; i++)
+        {
+            if (i > 0)
+            {
+                uint8_t previous[32];
+                std::memcpy(previous, digest, 32);
+                Blake2b::hash256(previous, 32, digest);
+            }
+            constants.push_back(toField(digest));
+        }
+        return constants;
+    }
+
+    // A 256 bit little endian number modulo p
+    static FieldT toField(const uint8_t *bytes)
+    {
+        libff::bigint<FieldT::num_limbs> low;
+        libff::bigint<FieldT::num_limbs> high;
+        libff::bigint<FieldT::num_limbs> shift;
+        for (unsigned int i = 0; i < FieldT::num_limbs; i++)
+        {
+            low.data[i] = 0;
+            high.data[i] = 0;
+            shift.data[i] = 0;
+        }
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            low.data[i / 8] |= mp_limb_t(bytes[i]) << (8 * (i % 8));
+            high.data[i / 8] |= mp_limb_t(bytes[16 + i]) << (8 * (i % 8));
+        }
+        // 2^128
+        shift.data[2] = 1;
+        return FieldT(low) + FieldT(high) * FieldT(shift);
+    }
+};
+
+// Native Poseidon, gives the same results as Poseidon_gadget_T<t, 1, nRoundsF, nRoundsP, ...>
+// without a protoboard.
+// Independent states are permuted together, one round at a time over all states, so the
+// field multiplications of the different states don't depend on each other and can be
+// executed in parallel by the CPU.
+// The permutation can also write the witness of the gadget, see NUM_VARIABLES.
+template <unsigned int t, unsigned int nRoundsF, unsigned int nRoundsP> class NativePoseidon
+{
+  public:
+    typedef std::array<FieldT, t> State;
+
+    // The number of states permuted together
+    static const unsigned int BATCH_SIZE = 8;
+
+    // The number of variables Poseidon_gadget_T (with a single output) allocates, in this order:
+    // x^2, x^4 and x^5 of every S-box, round by round (all t elements in the full rounds, the
+    // first element in the partial rounds), followed by the output. The state itself is never
+    // stored in a variable, it is a linear combination of these variables.
+    static const unsigned int NUM_VARIABLES = (nRoundsF * t + nRoundsP) * 3 + 1;
+
+    static const PoseidonParams &getParams()
+    {
+        static const PoseidonParams params(t, nRoundsF, nRoundsP);
+        return params;
+    }
+
+    // When `witnesses` is given the values of the gadget variables of every state are written
+    // to witnesses[i], NUM_VARIABLES values
+    static void permute(State *states, size_t count, FieldT *const *witnesses = nullptr)
+    {
+        const PoseidonParams &params = getParams();
+        for (size_t offset = 0; offset < count; offset += BATCH_SIZE)
+        {
+            permuteBatch(
+              params,
+              states + offset,
+              std::min<size_t>(BATCH_SIZE, count - offset),
+              witnesses ? witnesses + offset : nullptr);
+        }
+    }
+
+    // Hashes `count` inputs of `numInputs` values each (stored one after the other)
+    static void hash(const FieldT *inputs, size_t numInputs, size_t count, FieldT *results)
+    {
+        assert(numInputs > 0 && numInputs < t);
+        std::vector<State> states(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            std::copy(inputs + i * numInputs, inputs + (i + 1) * numInputs, states[i].begin());
+            std::fill(states[i].begin() + numInputs, states[i].end(), FieldT::zero());
+        }
+        permute(states.data(), count);
+        for (size_t i = 0; i < count; i++)
+        {
+            results[i] = states[i][0];
+        }
+    }
+
+    static FieldT hash(const std::vector<FieldT> &inputs)
+    {
+        FieldT result;
+        hash(inputs.data(), inputs.size(), 1, &result);
+        return result;
+    }
+
+  private:
+    // The states are processed in the inner loops so consecutive operations are independent
+    static void permuteBatch(const PoseidonParams &params, State *states, size_t count, FieldT *const *witnesses)
+    {
+        std::array<State, BATCH_SIZE> mixed;
+        unsigned int position = 0;
+        for (unsigned int round = 0; round < nRoundsF + nRoundsP; round++)
+        {
+            // Add the round constant
+            const FieldT &C_i = params.C[round];
+            for (unsigned int i = 0; i < t; i++)
+            {
+                for (size_t s = 0; s < count; s++)
+                {
+                    states[s][i] += C_i;
+                }
+            }
+            // S-box, on the first element only in the partial rounds
+            const bool fullRound = (round < nRoundsF / 2) || (round >= nRoundsF / 2 + nRoundsP);
+            const unsigned int numSBoxes = fullRound ? t : 1;
+            for (unsigned int i = 0; i < numSBoxes; i++)
+            {
+                for (size_t s = 0; s < count; s++)
+                {
+                    const FieldT x2 = states[s][i].squared();
+                    const FieldT x4 = x2.squared();
+                    const FieldT x5 = x4 * states[s][i];
+                    states[s][i] = x5;
+                    if (witnesses)
+                    {
+                        FieldT *witness = witnesses[s] + position + i * 3;
+                        witness[0] = x2;
+                        witness[1] = x4;
+                        witness[2] = x5;
+                    }
+                }
+            }
+            position += numSBoxes * 3;
+            // Mix
+            for (unsigned int i = 0; i < t; i++)
+            {
+                const FieldT *M_i = &params.M[i * t];
+                for (size_t s = 0; s < count; s++)
+                {
+                    mixed[s][i] = M_i[0] * states[s][0];
+                }
+                for (unsigned int j = 1; j < t; j++)
+                {
+                    for (size_t s = 0; s < count; s++)
+                    {
+                        mixed[s][i] += M_i[j] * states[s][j];
+                    }
+                }
+            }
+            std::copy(mixed.begin(), mixed.begin() + count, states);
+        }
+        // Output
+        if (witnesses)
+        {
+            for (size_t s = 0; s < count; s++)
+            {
+                witnesses[s][position] = states[s][0];
+            }
+        }
+        assert(position + 1 == NUM_VARIABLES);
+    }
+};
+
+// The native versions of the permutations in MathGadgets.h
+using NativePoseidon_2 = NativePoseidon<3, 6, 51>;
+using NativePoseidon_4 = NativePoseidon<5, 6, 52>;
+using NativePoseidon_5 = NativePoseidon<6, 6, 52>;
+using NativePoseidon_6 = NativePoseidon<7, 6, 52>;
+
+} // namespace Loopring
+
+#endif
@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2017 Loopring Technology Limited.
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include "Data.h"
+
+#include "ethsnarks.hpp"
+
+#include <cxxabi.h>
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+using namespace ethsnarks;
+
+namespace Loopring
+{
+
+static const size_t NO_PROFILER_SCOPE = size_t(-1);
+
+// Attributes the cost of the circuit to the gadgets that generated the constraints.
+// Gadgets generate their constraints inside (nested) scopes. Every constraint belongs to
+// the innermost scope it was generated in, every variable to the scope of the first
+// constraint that uses it.
+// Only the gadgets generated with profile_r1cs_constraints open a scope: the gadgets of the
+// block, the transactions and the gadgets of a transaction, so scopes are two levels deep.
+// The cost of everything inside those gadgets (e.g. the Merkle paths of an update) is part of
+// the closest profiled gadget. The report states this in "scope_depth" and "note".
+class CircuitProfiler
+{
+  public:
+    // The profiler collecting the scopes, nullptr when not profiling
+    static CircuitProfiler *&getActive()
+    {
+        static CircuitProfiler *active = nullptr;
+        return active;
+    }
+
+    void begin(const ProtoboardT &pb, const char *name, const std::string &className)
+    {
+        Scope scope;
+        scope.name = name;
+        scope.className = className;
+        scope.parent = stack.empty() ? NO_PROFILER_SCOPE : stack.back();
+        scope.constraintsBegin = pb.num_constraints();
+        scope.constraintsEnd = scope.constraintsBegin;
+        scopes.push_back(scope);
+        stack.push_back(scopes.size() - 1);
+    }
+
+    void end(const ProtoboardT &pb)
+    {
+        scopes[stack.back()].constraintsEnd = pb.num_constraints();
+        stack.pop_back();
+    }
+
+    size_t getNumScopes() const
+    {
+        return scopes.size();
+    }
+
+    // Moves the scopes starting at `firstScope` by `numConstraints` constraints.
+    // Used when the constraints were generated on a different protoboard.
+    void shiftScopes(size_t firstScope, size_t numConstraints)
+    {
+        for (size_t s = firstScope; s < scopes.size(); s++)
+        {
+            scopes[s].constraintsBegin += numConstraints;
+            scopes[s].constraintsEnd += numConstraints;
+        }
+    }
+
+    json report(const ProtoboardT &pb) const
+    {
+        // Innermost scope of every constraint
+        const size_t numConstraints = pb.num_constraints();
+        std::vector<size_t> owners(numConstraints, NO_PROFILER_SCOPE);
+        for (size_t s = 0; s < scopes.size(); s++)
+        {
+            for (size_t i = scopes[s].constraintsBegin; i < scopes[s].constraintsEnd; i++)
+            {
+                owners[i] = s;
+            }
+        }
+
+        // Cost of every scope without its children, the last entry is for constraints outside any scope
+        std::vector<Cost> costs(scopes.size() + 1);
+        std::vector<bool> used(pb.num_variables() + 1, false);
+        // The constant ONE is not counted
+        used[0] = true;
+        for (size_t i = 0; i < numConstraints; i++)
+        {
+            Cost &cost = costs[(owners[i] == NO_PROFILER_SCOPE) ? scopes.size() : owners[i]];
+            const auto &constraint = pb.constraint_system.constraints[i];
+            auto addTerms = [&](const libsnark::linear_combination<FieldT> &lc) {
+                for (const auto &term : lc.getTerms())
+                {
+                    cost.terms++;
+                    if (!used[term.index])
+                    {
+                        used[term.index] = true;
+                        cost.variables++;
+                    }
+                }
+            };
+            cost.constraints++;
+            addTerms(constraint->getA());
+            addTerms(constraint->getB());
+            addTerms(constraint->getC());
+        }
+
+        // Add the costs to all parents
+        std::vector<Cost> totalCosts(costs.begin(), costs.end() - 1);
+        for (size_t s = scopes.size(); s-- > 0;)
+        {
+            if (scopes[s].parent != NO_PROFILER_SCOPE)
+            {
+                totalCosts[scopes[s].parent] += totalCosts[s];
+            }
+        }
+
+        // Merge the scopes with the same path (e.g. the same gadget in all transactions)
+        Node root;
+        std::vector<Node *> nodes(scopes.size());
+        for (size_t s = 0; s < scopes.size(); s++)
+        {
+            Node &parent = (scopes[s].parent == NO_PROFILER_SCOPE) ? root : *nodes[scopes[s].parent];
+            Node &node = parent.getChild(scopes[s].name);
+            node.className = scopes[s].className;
+            node.instances++;
+            node.cost += totalCosts[s];
+            nodes[s] = &node;
+        }
+
+        // Totals per gadget class, nested scopes of the same class are only counted once
+        std::map<std::string, Node> classes;
+        for (size_t s = 0; s < scopes.size(); s++)
+        {
+            bool nested = false;
+            for (size_t p = scopes[s].parent; p != NO_PROFILER_SCOPE && !nested; p = scopes[p].parent)
+            {
+                nested = (scopes[p].className == scopes[s].className);
+            }
+            if (!nested)
+            {
+                Node &node = classes[scopes[s].className];
+                node.instances++;
+                node.cost += totalCosts[s];
+            }
+        }
+
+        size_t numUnused = 0;
+        for (bool u : used)
+        {
+            numUnused += u ? 0 : 1;
+        }
+
+        // Parents are always opened before their children
+        std::vector<size_t> depths(scopes.size());
+        size_t maxDepth = 0;
+        for (size_t s = 0; s < scopes.size(); s++)
+        {
+            depths[s] = (scopes[s].parent == NO_PROFILER_SCOPE) ? 1 : depths[scopes[s].parent] + 1;
+            maxDepth = std::max(maxDepth, depths[s]);
+        }
+
+        json j;
+        j["constraints"] = numConstraints;
+        j["variables"] = pb.num_variables();
+        j["inputs"] = pb.num_inputs();
+        j["unconstrained_variables"] = numUnused;
+        j["scope_depth"] = maxDepth;
+        j["note"] = "Only gadgets generated with profile_r1cs_constraints have a scope, the cost of the gadgets "
+                    "inside them is included in the closest profiled gadget";
+        j["unscoped"] = toJSON(costs.back());
+        j["classes"] = json::array();
+        for (const auto &c : classes)
+        {
+            json jClass = toJSON(c.second.cost);
+            jClass["class"] = c.first;
+            jClass["instances"] = c.second.instances;
+            j["classes"].push_back(jClass);
+        }
+        std::sort(j["classes"].begin(), j["classes"].end(), [](const json &a, const json &b) {
+            return a["constraints"].get<size_t>() > b["constraints"].get<size_t>();
+        });
+        j["scopes"] = toJSON(root)["children"];
+        return j;
+    }
+
+    // Name of the gadget class without the namespace
+    template <typename T> static std::string getClassName(const T &gadget)
+    {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(typeid(gadget).name(), nullptr, nullptr, &status);
+        std::string name = (status == 0) ? demangled : typeid(gadget).name();
+        free(demangled);
+        const std::string ns = "Loopring::";
+        return (name.compare(0, ns.size(), ns) == 0) ? name.substr(ns.size()) : name;
+    }
+
+  private:
+    struct Scope
+    {
+        std::string name;
+        std::string className;
+        size_t parent;
+        size_t constraintsBegin;
+        size_t constraintsEnd;
+    };
+
+    struct Cost
+    {
+        size_t constraints = 0;
+        size_t variables = 0;
+        size_t terms = 0;
+
+        Cost &operator+=(const Cost &other)
+        {
+            constraints += other.constraints;
+            variables += other.variables;
+            terms += other.terms;
+            return *this;
+        }
+    };
+
+    struct Node
+    {
+        std::string className;
+        size_t instances = 0;
+        Cost cost;
+        // In the order the scopes were first seen
+        std::vector<std::pair<std::string, std::unique_ptr<Node>>> children;
+
+        Node &getChild(const std::string &name)
+        {
+            for (auto &child : children)
+            {
+                if (child.first == name)
+                {
+                    return *child.second;
+                }
+            }
+            children.emplace_back(name, std::unique_ptr<Node>(new Node()));
+            return *children.back().second;
+        }
+    };
+
+    std::vector<Scope> scopes;
+    std::vector<size_t> stack;
+
+    static json toJSON(const Cost &cost)
+    {
+        json j;
+        j["constraints"] = cost.constraints;
+        j["variables"] = cost.variables;
+        j["terms"] = cost.terms;
+        return j;
+    }
+
+    static json toJSON(const Node &node)
+    {
+        json j = toJSON(node.cost);
+        j["class"] = node.className;
+        j["instances"] = node.instances;
+        j["children"] = json::array();
+        for (const auto &child : node.children)
+        {
+            json jChild = toJSON(*child.second);
+            jChild["name"] = child.first;
+            j["children"].push_back(jChild);
+        }
+        return j;
+    }
+};
+
+// Generates the constraints of a gadget inside a profiler scope
+template <typename T, typename... Args>
+void profile_r1cs_constraints(ProtoboardT &pb, const char *name, T &gadget, Args... args)
+{
+    CircuitProfiler *profiler = CircuitProfiler::getActive();
+    if (profiler)
+    {
+        profiler->begin(pb, name, CircuitProfiler::getClassName(gadget));
+    }
+    gadget.generate_r1cs_constraints(args...);
+    if (profiler)
+    {
+        profiler->end(pb);
+    }
+}
+
+} // namespace Loopring
+
+#endif
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2017 Loopring Technology Limited.
+#ifndef _UINT_H_
+#define _UINT_H_
+
+#include "ethsnarks.hpp"
+
+#include <gmp.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+using namespace ethsnarks;
+
+namespace Loopring
+{
+
+// A fixed-width unsigned integer of N limbs (least significant limb first) for the integer
+// math of the witness (divisions, floats). The limbs are the same as the limbs of
+// libff::bigint, so converting from and to a field element is a copy, and the arithmetic
+// is done with the GMP mpn functions libff also uses. The results need to fit in N limbs.
+template <unsigned int N> class UInt
+{
+  public:
+    static_assert(sizeof(mp_limb_t) == sizeof(uint64_t), "64-bit limbs expected");
+
+    mp_limb_t limbs[N];
+
+    UInt(uint64_t value = 0)
+    {
+        std::fill(limbs, limbs + N, 0);
+        limbs[0] = value;
+    }
+
+    explicit UInt(const FieldT &value)
+    {
+        static_assert(N >= FieldT::num_limbs, "a field element doesn't fit");
+        const auto bigint = value.as_bigint();
+        std::copy(bigint.data, bigint.data + FieldT::num_limbs, limbs);
+        std::fill(limbs + FieldT::num_limbs, limbs + N, 0);
+    }
+
+    // The value needs to be smaller than the field modulus
+    FieldT toField() const
+    {
+        libff::bigint<FieldT::num_limbs> bigint;
+        for (unsigned int i = 0; i < FieldT::num_limbs; i++)
+        {
+            bigint.data[i] = (i < N) ? limbs[i] : 0;
+        }
+        assert(getNumLimbs() <= FieldT::num_limbs);
+        return FieldT(bigint);
+    }
+
+    uint64_t toUint64() const
+    {
+        assert(getNumLimbs() <= 1);
+        return limbs[0];
+    }
+
+    // The number of limbs without the leading zero limbs
+    mp_size_t getNumLimbs() const
+    {
+        mp_size_t n = N;
+        while (n > 0 && limbs[n - 1] == 0)
+        {
+            n--;
+        }
+        return n;
+    }
+
+    bool isZero() const
+    {
+        return getNumLimbs() == 0;
+    }
+
+    int compare(const UInt &other) const
+    {
+        return mpn_cmp(limbs, other.limbs, N);
+    }
+
+    bool operator==(const UInt &other) const
+    {
+        return compare(other) == 0;
+    }
+
+    bool operator!=(const UInt &other) const
+    {
+        return compare(other) != 0;
+    }
+
+    bool operator<(const UInt &other) const
+    {
+        return compare(other) < 0;
+    }
+
+    bool operator<=(const UInt &other) const
+    {
+        return compare(other) <= 0;
+    }
+
+    bool operator>(const UInt &other) const
+    {
+        return compare(other) > 0;
+    }
+
+    bool operator>=(const UInt &other) const
+    {
+        return compare(other) >= 0;
+    }
+
+    // The full product, e.g. 256 x 256 -> 512 bits
+    template <unsigned int M> UInt<N + M> mul(const UInt<M> &other) const
+    {
+        UInt<N + M> result;
+        const mp_size_t n = getNumLimbs();
+        const mp_size_t m = other.getNumLimbs();
+        if (n == 0 || m == 0)
+        {
+            return result;
+        }
+        // mpn_mul needs the longest operand first
+        if (n >= m)
+        {
+            mpn_mul(result.limbs, limbs, n, other.limbs, m);
+        }
+        else
+        {
+            mpn_mul(result.limbs, other.limbs, m, limbs, n);
+        }
+        return result;
+    }
+
+    UInt operator*(const UInt &other) const
+    {
+        const UInt<N * 2> product = mul(other);
+        assert(product.getNumLimbs() <= mp_size_t(N));
+        UInt result;
+        std::copy(product.limbs, product.limbs + N, result.limbs);
+        return result;
+    }
+
+    UInt &operator*=(const UInt &other)
+    {
+        return *this = *this * other;
+    }
+
+    // Divides by `divisor` (which cannot be zero), rounding down
+    template <unsigned int M> void divide(const UInt<M> &divisor, UInt &quotient, UInt<M> &remainder) const
+    {
+        const mp_size_t n = getNumLimbs();
+        const mp_size_t m = divisor.getNumLimbs();
+        assert(m > 0);
+        UInt q;
+        UInt<M> r;
+        if (n < m)
+        {
+            std::copy(limbs, limbs + n, r.limbs);
+        }
+        else
+        {
+            mpn_tdiv_qr(q.limbs, r.limbs, 0, limbs, n, divisor.limbs, m);
+        }
+        quotient = q;
+        remainder = r;
+    }
+
+    UInt operator/(const UInt &divisor) const
+    {
+        UInt quotient;
+        UInt remainder;
+        divide(divisor, quotient, remainder);
+        return quotient;
+    }
+
+    UInt operator%(const UInt &divisor) const
+    {
+        UInt quotient;
+        UInt remainder;
+        divide(divisor, quotient, remainder);
+        return remainder;
+    }
+};
+
+using UInt256 = UInt<4>;
+using UInt512 = UInt<8>;
+
+} // namespace Loopring
+
+#endif
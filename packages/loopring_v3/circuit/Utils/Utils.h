@@ -5,8 +5,8 @@
 
 #include "Constants.h"
 #include "Data.h"
+#include "UInt.h"
 
-#include "../ThirdParty/BigIntHeader.hpp"
 #include "ethsnarks.hpp"
 #include "gadgets/merkle_tree.hpp"
 #include "gadgets/sha256_many.hpp"
@@ -118,73 +118,52 @@ static const VariableArrayT var_array(const std::vector<VariableT> &inputs)
     return VariableArrayT(inputs.begin(), inputs.end());
 }
 
-static BigInt toBigInt(ethsnarks::FieldT _value, bool sign = true)
-{
-    auto value = _value.as_bigint();
-    BigInt bi = 0;
-    for (unsigned int i = 0; i < value.num_bits(); i++)
-    {
-        bi = bi * 2 + (value.test_bit(value.num_bits() - 1 - i) ? 1 : 0);
-    }
-    if (!sign)
-    {
-        bi = -bi;
-    }
-    return bi;
-}
-
-static unsigned int toFloat(BigInt value, const FloatEncoding &encoding)
+static unsigned int toFloat(const ethsnarks::FieldT &_value, const FloatEncoding &encoding)
 {
     const unsigned int maxExponent = (1 << encoding.numBitsExponent) - 1;
     const unsigned int maxMantissa = (1 << encoding.numBitsMantissa) - 1;
-    BigInt maxExponentValue = 1;
+    UInt256 maxExponentValue = 1;
     for (unsigned int i = 0; i < maxExponent; i++)
     {
         maxExponentValue *= encoding.exponentBase;
     }
-    BigInt maxValue = BigInt(maxMantissa) * BigInt(maxExponentValue);
+    UInt256 maxValue = UInt256(maxMantissa) * maxExponentValue;
+    const UInt256 value(_value);
     assert(value <= maxValue);
 
     unsigned int exponent = 0;
-    BigInt r = value / BigInt(maxMantissa);
-    BigInt d = 1;
+    UInt256 r = value / maxMantissa;
+    UInt256 d = 1;
     while (r >= encoding.exponentBase || d * maxMantissa < value)
     {
         r = r / encoding.exponentBase;
         exponent += 1;
         d = d * encoding.exponentBase;
     }
-    BigInt mantissa = value / d;
+    UInt256 mantissa = value / d;
 
     assert(exponent <= maxExponent);
     assert(mantissa <= maxMantissa);
-    const unsigned int f = (exponent << encoding.numBitsMantissa) + mantissa.to_long();
+    const unsigned int f = (exponent << encoding.numBitsMantissa) + mantissa.toUint64();
     return f;
 }
 
-static unsigned int toFloat(ethsnarks::FieldT value, const FloatEncoding &encoding)
-{
-    return toFloat(toBigInt(value), encoding);
-}
-
-static BigInt fromFloat(unsigned int f, const FloatEncoding &encoding)
+static ethsnarks::FieldT fromFloat(unsigned int f, const FloatEncoding &encoding)
 {
     const unsigned int exponent = f >> encoding.numBitsMantissa;
     const unsigned int mantissa = f & ((1 << encoding.numBitsMantissa) - 1);
-    BigInt multiplier = 1;
+    UInt256 multiplier = 1;
     for (unsigned int i = 0; i < exponent; i++)
     {
         multiplier *= 10;
     }
-    BigInt value = BigInt(mantissa) * multiplier;
-    return value;
+    UInt256 value = UInt256(mantissa) * multiplier;
+    return value.toField();
 }
 
 static FieldT roundToFloatValue(const FieldT &value, const FloatEncoding &encoding)
 {
-    auto f = toFloat(value, encoding);
-    auto floatValue = fromFloat(f, encoding);
-    return FieldT(floatValue.to_string().c_str());
+    return fromFloat(toFloat(value, encoding), encoding);
 }
 
 } // namespace Loopring
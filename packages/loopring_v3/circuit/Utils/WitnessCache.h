@@ -0,0 +1,142 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2017 Loopring Technology Limited.
+#ifndef _WITNESSCACHE_H_
+#define _WITNESSCACHE_H_
+
+#include "ethsnarks.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace ethsnarks;
+
+namespace Loopring
+{
+
+// Caches the witness of gadgets whose witness only depends on the values of their inputs,
+// keyed on those input values. Can be used by multiple threads at the same time.
+class WitnessCache
+{
+  public:
+    // The cache is split up in shards that are locked separately
+    static const unsigned int NUM_SHARDS = 64;
+
+    WitnessCache(size_t maxValues) : maxValuesPerShard(maxValues / NUM_SHARDS), hits(0), misses(0)
+    {
+    }
+
+    static WitnessCache &getInstance()
+    {
+        // 2M field elements, 64MB
+        static WitnessCache cache(1 << 21);
+        return cache;
+    }
+
+    // A key for `values` of the gadget with identifier `id`
+    static std::string getKey(size_t id, const std::vector<FieldT> &values)
+    {
+        std::string key((const char *)&id, sizeof(id));
+        key.reserve(sizeof(id) + values.size() * FieldT::num_limbs * sizeof(mp_limb_t));
+        for (const FieldT &value : values)
+        {
+            const auto bigint = value.as_bigint();
+            key.append((const char *)bigint.data, sizeof(bigint.data));
+        }
+        return key;
+    }
+
+    // Copies the cached witness to `witness`. Returns false when the key isn't cached.
+    bool lookup(const std::string &key, FieldT *witness, size_t size)
+    {
+        Shard &shard = getShard(key);
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            auto it = shard.entries.find(key);
+            if (it != shard.entries.end() && it->second.size() == size)
+            {
+                std::copy(it->second.begin(), it->second.end(), witness);
+                hits++;
+                return true;
+            }
+        }
+        misses++;
+        return false;
+    }
+
+    void insert(const std::string &key, const FieldT *witness, size_t size)
+    {
+        Shard &shard = getShard(key);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        // Simply start over when full, the values that are used a lot are added again quickly
+        if (shard.numValues + size > maxValuesPerShard)
+        {
+            shard.entries.clear();
+            shard.numValues = 0;
+        }
+        if (shard.entries.emplace(key, std::vector<FieldT>(witness, witness + size)).second)
+        {
+            shard.numValues += size;
+        }
+    }
+
+    uint64_t getHits() const
+    {
+        return hits;
+    }
+
+    uint64_t getMisses() const
+    {
+        return misses;
+    }
+
+    double getHitRate() const
+    {
+        const uint64_t lookups = hits + misses;
+        return lookups ? double(hits) / lookups : 0.0;
+    }
+
+    void resetStatistics()
+    {
+        hits = 0;
+        misses = 0;
+    }
+
+    void clear()
+    {
+        for (Shard &shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            shard.entries.clear();
+            shard.numValues = 0;
+        }
+        resetStatistics();
+    }
+
+  private:
+    struct Shard
+    {
+        std::mutex mtx;
+        std::unordered_map<std::string, std::vector<FieldT>> entries;
+        size_t numValues = 0;
+    };
+
+    const size_t maxValuesPerShard;
+    std::array<Shard, NUM_SHARDS> shards;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+
+    Shard &getShard(const std::string &key)
+    {
+        return shards[std::hash<std::string>()(key) % NUM_SHARDS];
+    }
+};
+
+} // namespace Loopring
+
+#endif
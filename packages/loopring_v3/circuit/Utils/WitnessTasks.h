@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: Apache-2.0
+// Copyright 2017 Loopring Technology Limited.
+#ifndef _WITNESSTASKS_H_
+#define _WITNESSTASKS_H_
+
+#ifdef MULTICORE
+#include <omp.h>
+#endif
+
+namespace Loopring
+{
+
+// Runs independent parts of a witness as OpenMP tasks, so idle threads of the team (e.g.
+// threads without a transaction of their own) can pick them up. A task only runs after
+// everything that came before it in the same function, so a chain of dependent parts is
+// a single task. Without MULTICORE, or outside of a parallel region, the tasks run directly.
+class WitnessTasks
+{
+  public:
+    ~WitnessTasks()
+    {
+        wait();
+    }
+
+    template <typename F> void run(F f)
+    {
+#ifdef MULTICORE
+#pragma omp task firstprivate(f)
+#endif
+        f();
+    }
+
+    // Waits until all tasks are done
+    void wait()
+    {
+#ifdef MULTICORE
+#pragma omp taskwait
+#endif
+    }
+
+    // Runs `f` on a team of `numThreads` threads when not already in a parallel region,
+    // so the tasks created by `f` can be run in parallel
+    template <typename F> static void runParallel(unsigned int numThreads, const F &f)
+    {
+#ifdef MULTICORE
+        if (numThreads > 1 && !omp_in_parallel())
+        {
+#pragma omp parallel num_threads(numThreads)
+#pragma omp single
+            f();
+            return;
+        }
+#endif
+        f();
+    }
+};
+
+} // namespace Loopring
+
+#endif
@@ -1,9 +1,15 @@
 // SPDX-License-Identifier: Apache-2.0
 // Copyright 2017 Loopring Technology Limited.
 
-#include "ThirdParty/BigInt.hpp"
 #include "Utils/Data.h"
 #include "Circuits/UniversalCircuit.h"
+#include "Utils/ConstraintSystem.h"
+#include "Utils/BinaryBlock.h"
+#include "Utils/BlockDecoder.h"
+#include "Utils/BlockingQueue.h"
+#include "Utils/BlockValidator.h"
+#include "Utils/Profiler.h"
+#include "Utils/WitnessCache.h"
 
 #include "ThirdParty/httplib.h"
 //#include "ThirdParty/json.hpp"
@@ -13,6 +19,18 @@
 #include <fstream>
 #include <chrono>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #ifdef MULTICORE
 #include <omp.h>
@@ -97,7 +115,8 @@ enum class Mode
     ExportCircuit,
     ExportWitness,
     Server,
-    Benchmark
+    Benchmark,
+    Profile
 };
 
 namespace libsnark
@@ -172,6 +191,35 @@ static void from_json(const nlohmann::json &j, BenchmarkConfig &config)
     config.multi_exp_look_ahead = j.at("multi_exp_look_ahead").get<std::vector<unsigned int>>();
 }
 
+// Optional "server" section in config.json
+struct ServerConfig
+{
+    // Generate the witness of the next block while the current block is being proven.
+    // Needs a second copy of the circuit in memory.
+    bool pipeline = true;
+    // Block sizes that can be proven (defaults to the size of the block passed on the command line)
+    std::vector<unsigned int> blockSizes;
+    // Circuits and proving keys are unloaded (least recently used first) when they don't fit
+    // in this budget. 0 means no limit.
+    unsigned int memoryBudgetMB = 0;
+};
+
+static void from_json(const nlohmann::json &j, ServerConfig &config)
+{
+    if (j.contains("pipeline"))
+    {
+        config.pipeline = j.at("pipeline").get<bool>();
+    }
+    if (j.contains("block_sizes"))
+    {
+        config.blockSizes = j.at("block_sizes").get<std::vector<unsigned int>>();
+    }
+    if (j.contains("memory_budget_mb"))
+    {
+        config.memoryBudgetMB = j.at("memory_budget_mb").get<unsigned int>();
+    }
+}
+
 static inline auto now() -> decltype(std::chrono::high_resolution_clock::now())
 {
     return std::chrono::high_resolution_clock::now();
@@ -195,6 +243,25 @@ bool fileExists(const std::string &fileName)
     return infile.good();
 }
 
+size_t getFileSize(const std::string &fileName)
+{
+    std::ifstream infile(fileName.c_str(), std::ifstream::ate | std::ifstream::binary);
+    return infile.good() ? size_t(infile.tellg()) : 0;
+}
+
+// Resident set size of the process in bytes (0 if unknown)
+size_t getResidentMemory()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0;
+    size_t resident = 0;
+    if (!(statm >> size >> resident))
+    {
+        return 0;
+    }
+    return resident * size_t(sysconf(_SC_PAGESIZE));
+}
+
 void initProverContextBuffers(ProverContextT &context)
 {
     context.scratch_exponents.resize(std::max(context.constraint_system->num_variables() + 1, context.domain->m - 1));
@@ -245,11 +312,171 @@ json loadJSON(const std::string &filename)
     return input;
 }
 
+// A block to prove, either a json block or a block in the binary block format.
+// Binary blocks are decoded directly. Json blocks are only checked here, the transactions
+// are decoded while the witness is generated (see generateWitness).
+struct BlockInput
+{
+    unsigned int blockType = 0;
+    unsigned int blockSize = 0;
+    std::unique_ptr<Loopring::Block> block;
+    // The json block, either stored in a file or in memory
+    std::string filename;
+    std::string data;
+};
+
+// Parses a block sent as json or in the binary block format
+bool parseBlockInput(std::string &body, BlockInput &input, std::string &error)
+{
+    if (Loopring::BinaryBlock::isBinary(body.data(), body.size()))
+    {
+        input.block.reset(new Loopring::Block());
+        return Loopring::BinaryBlock::decode(
+          body.data(), body.size(), input.blockType, input.blockSize, *input.block, error);
+    }
+    Loopring::Block header;
+    Loopring::BlockDecoder decoder(header);
+    decoder.headerOnly();
+    if (!decoder.decode(body))
+    {
+        error = decoder.getError();
+        return false;
+    }
+    input.blockType = decoder.getBlockType();
+    input.blockSize = decoder.getBlockSize();
+    // Don't keep two copies of the block in memory
+    input.data.swap(body);
+    return true;
+}
+
+bool loadBlockInput(const std::string &filename, BlockInput &input, std::string &error)
+{
+    if (Loopring::BinaryBlock::isBinaryFile(filename))
+    {
+        input.block.reset(new Loopring::Block());
+        return Loopring::BinaryBlock::load(filename, input.blockType, input.blockSize, *input.block, error);
+    }
+    std::ifstream file(filename.c_str());
+    if (!file.is_open())
+    {
+        error = "Cannot open json file: " + filename;
+        return false;
+    }
+    Loopring::Block header;
+    Loopring::BlockDecoder decoder(header);
+    decoder.headerOnly();
+    if (!decoder.decode(file))
+    {
+        error = decoder.getError();
+        return false;
+    }
+    input.blockType = decoder.getBlockType();
+    input.blockSize = decoder.getBlockSize();
+    input.filename = filename;
+    return true;
+}
+
+// Decodes a json block with `decoder`, from the file or from memory
+bool decodeBlockInput(const BlockInput &input, Loopring::BlockDecoder &decoder, std::string &error)
+{
+    bool decoded = false;
+    if (!input.filename.empty())
+    {
+        std::ifstream file(input.filename.c_str());
+        if (!file.is_open())
+        {
+            error = "Cannot open json file: " + input.filename;
+            return false;
+        }
+        decoded = decoder.decode(file);
+    }
+    else
+    {
+        decoded = decoder.decode(input.data);
+    }
+    if (!decoded)
+    {
+        error = decoder.getError();
+    }
+    return decoded;
+}
+
+// Decodes the complete block
+bool loadBlock(const BlockInput &input, Loopring::Block &block, std::string &error)
+{
+    if (input.block)
+    {
+        block = *input.block;
+        return true;
+    }
+    Loopring::BlockDecoder decoder(block);
+    return decodeBlockInput(input, decoder, error);
+}
+
+// Checks the block natively (Merkle proofs, root chaining, signatures, numeric limits)
+// so an invalid block is rejected before any circuit work. The complete block is needed,
+// so a json block is decoded here (and not streamed while the witness is generated).
+bool preValidateBlock(BlockInput &input, std::string &error)
+{
+    std::cout << "Pre-validating block..." << std::endl;
+    auto begin = now();
+    if (!input.block)
+    {
+        std::unique_ptr<Loopring::Block> block(new Loopring::Block());
+        if (!loadBlock(input, *block, error))
+        {
+            return false;
+        }
+        input.block = std::move(block);
+        std::string().swap(input.data);
+    }
+    Loopring::BlockValidator validator(*input.block);
+    if (!validator.validate(error))
+    {
+        error = "Block is invalid: " + error;
+        return false;
+    }
+    print_time(begin, "Block pre-validated");
+    return true;
+}
+
+// Converts a json block to the binary block format
+bool convertBlock(const std::string &jsonFilename, const std::string &binaryFilename)
+{
+    auto begin = now();
+    BlockInput input;
+    Loopring::Block block;
+    std::string error;
+    if (!loadBlockInput(jsonFilename, input, error) || !loadBlock(input, block, error))
+    {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    if (!Loopring::BinaryBlock::write(binaryFilename, input.blockType, input.blockSize, block))
+    {
+        std::cerr << "Cannot create block file: " << binaryFilename << std::endl;
+        return false;
+    }
+    std::cout << getFileSize(jsonFilename) << " bytes -> " << getFileSize(binaryFilename) << " bytes" << std::endl;
+    print_time(begin, "Block converted");
+    return true;
+}
+
 libsnark::Config loadConfig(const std::string &filename)
 {
     return loadJSON(filename).get<libsnark::Config>();
 }
 
+ServerConfig loadServerConfig(const std::string &filename)
+{
+    json j = loadJSON(filename);
+    if (j.contains("server"))
+    {
+        return j.at("server").get<ServerConfig>();
+    }
+    return ServerConfig();
+}
+
 void loadProvingKey(const std::string &pk_file, ethsnarks::ProvingKeyT &proving_key)
 {
     std::cout << "Loading proving key " << pk_file << "..." << std::endl;
@@ -277,6 +504,7 @@ std::string proveCircuit(ProverContextT &context, Loopring::Circuit *circuit)
 {
     std::cout << "Generating proof..." << std::endl;
     auto begin = now();
+    // The witness map of the prover evaluates the constraints of the protoboard
     std::string jProof = ethsnarks::prove(context, circuit->getPb());
     unsigned int elapsed_ms = elapsed_time_ms(begin);
     elapsed_ms = elapsed_ms == 0 ? 1 : elapsed_ms;
@@ -285,130 +513,1018 @@ std::string proveCircuit(ProverContextT &context, Loopring::Circuit *circuit)
     return jProof;
 }
 
-bool writeProof(const std::string &jProof, const std::string &proofFilename)
+bool writeProfile(
+  const Loopring::CircuitProfiler &profiler,
+  const ethsnarks::ProtoboardT &pb,
+  const std::string &filename)
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        std::cerr << "Cannot create profile file: " << filename << std::endl;
+        return false;
+    }
+    file << profiler.report(pb).dump(4) << std::endl;
+    std::cout << "Profile written to: " << filename << std::endl;
+    return true;
+}
+
+bool writeProof(const std::string &jProof, const std::string &proofFilename)
+{
+    std::ofstream fproof(proofFilename);
+    if (!fproof.is_open())
+    {
+        std::cerr << "Cannot create proof file: " << proofFilename << std::endl;
+        return false;
+    }
+    fproof << jProof;
+    fproof.close();
+    std::cout << "Proof written to: " << proofFilename << std::endl;
+    return true;
+}
+
+Loopring::Circuit *newCircuit(unsigned int blockType, ethsnarks::ProtoboardT &outPb)
+{
+    return new Loopring::UniversalCircuit(outPb, "circuit");
+}
+
+std::string getProvingKeyFilename(const std::string &baseFilename)
+{
+    return baseFilename + "_pk.raw";
+}
+
+std::string getConstraintSystemFilename(const std::string &baseFilename)
+{
+    return baseFilename + "_cs.raw";
+}
+
+// Hash of the complete proving key. The key is only hashed once: the hash is stored next to the
+// key together with the size and modification time of the key it was computed for.
+uint64_t getProvingKeyHash(const std::string &baseFilename)
+{
+    std::string provingKeyFilename = getProvingKeyFilename(baseFilename);
+    struct stat st;
+    if (stat(provingKeyFilename.c_str(), &st) != 0)
+    {
+        return 0;
+    }
+    const uint64_t size = st.st_size;
+    const uint64_t modified = st.st_mtime;
+    std::string hashFilename = baseFilename + "_pk.hash";
+    std::ifstream stored(hashFilename);
+    uint64_t storedSize = 0;
+    uint64_t storedModified = 0;
+    uint64_t hash = 0;
+    if ((stored >> storedSize >> storedModified >> hash) && storedSize == size && storedModified == modified)
+    {
+        return hash;
+    }
+    std::cout << "Hashing proving key..." << std::endl;
+    auto begin = now();
+    hash = Loopring::FlatConstraintSystem::hashFile(provingKeyFilename);
+    std::ofstream file(hashFilename, std::ios::trunc);
+    file << size << " " << modified << " " << hash << std::endl;
+    print_time(begin, "Proving key hashed");
+    return hash;
+}
+
+// Caches the constraints together with the hash of the proving key they belong to
+bool writeConstraintSystemCache(const ethsnarks::ProtoboardT &pb, const std::string &baseFilename)
+{
+    std::cout << "Writing constraint system cache..." << std::endl;
+    auto begin = now();
+    Loopring::FlatConstraintSystem cs;
+    cs.build(pb, getProvingKeyHash(baseFilename));
+    if (!cs.write(getConstraintSystemFilename(baseFilename)))
+    {
+        std::cerr << "Failed to write constraint system cache!" << std::endl;
+        return false;
+    }
+    print_time(begin, "Constraint system cache written");
+    return true;
+}
+
+// Loads the constraints from the cache if it was created for the current proving key.
+// Only the variables of the circuit are allocated, which is a lot faster than generating the constraints.
+// When `constraintSystem` is given the constraints are only mapped into it and not added to the
+// protoboard, which is all that is needed to generate and check a witness.
+bool loadConstraintSystemCache(
+  Loopring::Circuit *circuit,
+  unsigned int blockSize,
+  const std::string &baseFilename,
+  Loopring::FlatConstraintSystem *constraintSystem)
+{
+    std::string provingKeyFilename = getProvingKeyFilename(baseFilename);
+    Loopring::FlatConstraintSystem mappedConstraintSystem;
+    Loopring::FlatConstraintSystem &cs = constraintSystem ? *constraintSystem : mappedConstraintSystem;
+    if (!fileExists(provingKeyFilename) || !cs.load(getConstraintSystemFilename(baseFilename)))
+    {
+        return false;
+    }
+    const Loopring::FlatConstraintSystem::Header &header = cs.getHeader();
+    if (header.keyFingerprint != getProvingKeyHash(baseFilename))
+    {
+        std::cout << "Constraint system cache is outdated" << std::endl;
+        cs.clear();
+        return false;
+    }
+    circuit->generateVariables(blockSize);
+    ethsnarks::ProtoboardT &pb = circuit->getPb();
+    if (pb.num_variables() != header.numVariables || pb.num_inputs() != header.numInputs)
+    {
+        std::cout << "Constraint system cache does not match the circuit" << std::endl;
+        cs.clear();
+        return false;
+    }
+    if (constraintSystem)
+    {
+        std::cout << "Constraints mapped from cache" << std::endl;
+        return true;
+    }
+    cs.addTo(pb);
+    std::cout << "Constraints loaded from cache" << std::endl;
+    return true;
+}
+
+// Creates the circuit. When a base filename is given the constraints are loaded from
+// the constraint system cache of the proving key (the cache is created if needed).
+// When `constraintSystem` is given a cached constraint system is kept there instead of being
+// added to the protoboard (see loadConstraintSystemCache).
+Loopring::Circuit *createCircuit(
+  unsigned int blockType,
+  unsigned int blockSize,
+  ethsnarks::ProtoboardT &outPb,
+  const std::string &baseFilename = "",
+  Loopring::FlatConstraintSystem *constraintSystem = nullptr)
+{
+    std::cout << "Creating circuit... " << std::endl;
+    auto begin = now();
+    Loopring::Circuit *circuit = newCircuit(blockType, outPb);
+    size_t numVariables = outPb.num_variables();
+    bool cached =
+      !baseFilename.empty() && loadConstraintSystemCache(circuit, blockSize, baseFilename, constraintSystem);
+    if (!cached)
+    {
+        if (outPb.num_variables() != numVariables)
+        {
+            // The cache was invalid, start from scratch
+            delete circuit;
+            outPb = ethsnarks::ProtoboardT();
+            circuit = newCircuit(blockType, outPb);
+        }
+        circuit->generateConstraints(blockSize);
+        if (!baseFilename.empty() && fileExists(getProvingKeyFilename(baseFilename)))
+        {
+            writeConstraintSystemCache(outPb, baseFilename);
+        }
+    }
+    if (constraintSystem && constraintSystem->isLoaded())
+    {
+        std::cout << constraintSystem->getHeader().numConstraints << " constraints (mapped)" << std::endl;
+    }
+    else
+    {
+        circuit->printInfo();
+    }
+    outPb.constraint_system.constraints.shrink_to_fit();
+    outPb.values.shrink_to_fit();
+    libsnark::ConstantStorage<FieldT>::getInstance().constants.shrink_to_fit();
+    print_time(begin, "Circuit created");
+    return circuit;
+}
+
+bool generateWitness(Loopring::Circuit *circuit, const BlockInput &input)
+{
+    std::cout << "Generating witness... " << std::endl;
+    auto begin = now();
+    const std::vector<std::pair<std::string, Loopring::WitnessCache *>> witnessCaches = {
+      {"Hash", &Loopring::WitnessCache::getInstance()},
+      {"Dummy transaction", &Loopring::TransactionGadget::getDummyWitnessCache()},
+      {"Signature", &Loopring::SignatureVerifier::getWitnessCache()}};
+    for (const auto &witnessCache : witnessCaches)
+    {
+        witnessCache.second->resetStatistics();
+    }
+    bool generated = false;
+    if (input.block)
+    {
+        generated = circuit->generateWitness(*input.block);
+    }
+    else
+    {
+        // The witness of every transaction is generated as soon as it is decoded.
+        // When the transactions come before the rest of the block data they are
+        // decoded first and the witness is generated afterwards.
+        Loopring::Block block;
+        Loopring::BlockDecoder decoder(block);
+        decoder.stream(
+          [&](const Loopring::Block &header) { return circuit->beginWitness(header); },
+          [&](Loopring::UniversalTransaction &transaction) {
+              return circuit->addTransactionWitness(std::move(transaction));
+          });
+        std::string error;
+        bool decoded = decodeBlockInput(input, decoder, error);
+        if (!decoded)
+        {
+            std::cerr << error << std::endl;
+        }
+        if (decoder.isStreaming())
+        {
+            generated = circuit->endWitness(block) && decoded;
+        }
+        else
+        {
+            generated = decoded && circuit->generateWitness(block);
+        }
+    }
+    if (!generated)
+    {
+        std::cerr << "Could not generate witness!" << std::endl;
+        return false;
+    }
+    print_time(begin, "Witness generated");
+    for (const auto &witnessCache : witnessCaches)
+    {
+        const Loopring::WitnessCache &cache = *witnessCache.second;
+        std::cout << witnessCache.first << " witness cache hit rate: " << cache.getHitRate() * 100 << "% ("
+                  << cache.getHits() << " of " << cache.getHits() + cache.getMisses() << ")" << std::endl;
+    }
+    return true;
+}
+
+// Describes the first unsatisfied constraint: its index, the transaction it belongs to and
+// the annotation of its gadget (only available in debug builds)
+std::string describeUnsatisfiedConstraint(
+  Loopring::Circuit *circuit,
+  const Loopring::FlatConstraintSystem *cs,
+  uint64_t constraint)
+{
+    const ProtoboardT &pb = circuit->getPb();
+    const uint64_t numConstraints = cs ? cs->getHeader().numConstraints : pb.num_constraints();
+    if (constraint >= numConstraints)
+    {
+        return "the variables don't match the constraint system";
+    }
+    std::string description = "constraint " + std::to_string(constraint) + " is not satisfied";
+    const libsnark::var_index_t variable =
+      cs ? cs->getMaxVariable(constraint) : Loopring::getMaxVariable(pb, constraint);
+    const int transaction = circuit->getTransactionIndex(variable);
+    if (transaction >= 0)
+    {
+        description += " (transaction " + std::to_string(transaction) + ")";
+    }
+    const std::string annotation = Loopring::getAnnotation(pb, constraint);
+    if (!annotation.empty())
+    {
+        description += ": " + annotation;
+    }
+    return description;
+}
+
+// Checks if the witness satisfies all constraints, on failure `error` describes the first
+// constraint that isn't satisfied
+bool validateCircuit(Loopring::Circuit *circuit, std::string &error, const Loopring::FlatConstraintSystem *cs = nullptr)
+{
+    std::cout << "Validating block..." << std::endl;
+    auto begin = now();
+    // Check if the inputs are valid for the circuit
+    uint64_t constraint = 0;
+    bool satisfied =
+      cs ? cs->isSatisfied(circuit->getPb(), &constraint) : Loopring::isSatisfied(circuit->getPb(), &constraint);
+    if (!satisfied)
+    {
+        error = describeUnsatisfiedConstraint(circuit, cs, constraint);
+        std::cerr << "Block is not valid: " << error << std::endl;
+        return false;
+    }
+    print_time(begin, "Block is valid");
+    return true;
+}
+
+std::string getBaseName(unsigned int blockType)
+{
+    switch (blockType)
+    {
+        default:
+            return "all";
+    }
+}
+
+enum class ProverJobStatus
+{
+    Queued = 0,
+    Running,
+    Done,
+    Failed,
+    Cancelled
+};
+
+std::string toString(ProverJobStatus status)
+{
+    switch (status)
+    {
+        case ProverJobStatus::Queued:
+            return "queued";
+        case ProverJobStatus::Running:
+            return "running";
+        case ProverJobStatus::Done:
+            return "done";
+        case ProverJobStatus::Failed:
+            return "failed";
+        default:
+            return "cancelled";
+    }
+}
+
+struct ProverJob
+{
+    unsigned int id;
+    std::string blockFilename;
+    // The block itself when it was sent in the request (blockFilename is empty).
+    // Released as soon as the witness is generated.
+    std::shared_ptr<BlockInput> block;
+    std::string proofFilename;
+    bool validate;
+
+    ProverJobStatus status = ProverJobStatus::Queued;
+    // "witness" or "proving" while running
+    std::string stage;
+    std::string proof;
+    std::string error;
+
+    decltype(now()) queuedAt;
+    decltype(now()) startedAt;
+    decltype(now()) finishedAt;
+};
+
+// Thread safe FIFO queue of blocks to prove.
+// Finished jobs are kept around (up to a limit) so clients can poll for the results.
+class ProverJobQueue
+{
+  public:
+    static const unsigned int MAX_FINISHED_JOBS = 1024;
+
+    ProverJobQueue() : nextJobID(0), stopped(false)
+    {
+    }
+
+    // Sets the ID of the new job. Returns false when the queue is stopped.
+    bool add(
+      const std::string &blockFilename,
+      const std::shared_ptr<BlockInput> &block,
+      const std::string &proofFilename,
+      bool validate,
+      unsigned int &id)
+    {
+        std::shared_ptr<ProverJob> job = std::make_shared<ProverJob>();
+        job->blockFilename = blockFilename;
+        job->block = block;
+        job->proofFilename = proofFilename;
+        job->validate = validate;
+        job->queuedAt = now();
+        {
+            const std::lock_guard<std::mutex> lock(mtx);
+            if (stopped)
+            {
+                return false;
+            }
+            job->id = nextJobID++;
+            jobs[job->id] = job;
+            queued.push_back(job);
+        }
+        cv.notify_one();
+        id = job->id;
+        return true;
+    }
+
+    // Blocks until a job is available. Returns nullptr when the queue is stopped.
+    std::shared_ptr<ProverJob> next()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this] { return stopped || !queued.empty(); });
+        if (stopped)
+        {
+            return nullptr;
+        }
+        std::shared_ptr<ProverJob> job = queued.front();
+        queued.pop_front();
+        job->status = ProverJobStatus::Running;
+        job->stage = "witness";
+        job->startedAt = now();
+        running.push_back(job->id);
+        return job;
+    }
+
+    void setStage(const std::shared_ptr<ProverJob> &job, const std::string &stage)
+    {
+        const std::lock_guard<std::mutex> lock(mtx);
+        job->stage = stage;
+    }
+
+    void finish(const std::shared_ptr<ProverJob> &job, const std::string &proof, const std::string &error)
+    {
+        const std::lock_guard<std::mutex> lock(mtx);
+        job->status = error.empty() ? ProverJobStatus::Done : ProverJobStatus::Failed;
+        job->stage.clear();
+        job->proof = proof;
+        job->error = error;
+        job->finishedAt = now();
+        running.erase(std::remove(running.begin(), running.end(), job->id), running.end());
+        addFinished(job);
+        cvFinished.notify_all();
+    }
+
+    // Blocks until the job is finished. Returns false for unknown jobs.
+    bool wait(unsigned int id, std::string &proof, std::string &error)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        auto it = jobs.find(id);
+        if (it == jobs.end())
+        {
+            error = "Unknown job";
+            return false;
+        }
+        // Keep the job alive, it could be dropped from the finished list while waiting
+        std::shared_ptr<ProverJob> job = it->second;
+        cvFinished.wait(lock, [&job] {
+            return job->status != ProverJobStatus::Queued && job->status != ProverJobStatus::Running;
+        });
+        if (job->status != ProverJobStatus::Done)
+        {
+            error = job->error.empty() ? "Job is " + toString(job->status) : job->error;
+            return false;
+        }
+        proof = job->proof;
+        return true;
+    }
+
+    // Stops the queue. Jobs that were not started yet are cancelled.
+    void stop()
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mtx);
+            stopped = true;
+            for (auto &job : queued)
+            {
+                job->status = ProverJobStatus::Cancelled;
+                job->finishedAt = now();
+                addFinished(job);
+            }
+            queued.clear();
+        }
+        cv.notify_all();
+        cvFinished.notify_all();
+    }
+
+    bool getProof(unsigned int id, std::string &proof, std::string &error)
+    {
+        const std::lock_guard<std::mutex> lock(mtx);
+        auto it = jobs.find(id);
+        if (it == jobs.end())
+        {
+            error = "Unknown job";
+            return false;
+        }
+        const ProverJob &job = *(it->second);
+        if (job.status != ProverJobStatus::Done)
+        {
+            error = job.error.empty() ? "Job is " + toString(job.status) : job.error;
+            return false;
+        }
+        proof = job.proof;
+        return true;
+    }
+
+    json getJob(unsigned int id)
+    {
+        const std::lock_guard<std::mutex> lock(mtx);
+        auto it = jobs.find(id);
+        if (it == jobs.end())
+        {
+            return json();
+        }
+        json j = toJSON(*(it->second));
+        if (it->second->status == ProverJobStatus::Queued)
+        {
+            auto pos = std::find(queued.begin(), queued.end(), it->second);
+            j["queue_position"] = (unsigned int)(pos - queued.begin());
+        }
+        return j;
+    }
+
+    json getJobs()
+    {
+        const std::lock_guard<std::mutex> lock(mtx);
+        json j;
+        j["queued"] = json::array();
+        j["running"] = json::array();
+        j["finished"] = json::array();
+        for (const auto &job : queued)
+        {
+            j["queued"].push_back(toJSON(*job));
+        }
+        for (unsigned int id : running)
+        {
+            j["running"].push_back(toJSON(*jobs[id]));
+        }
+        for (unsigned int id : finished)
+        {
+            j["finished"].push_back(toJSON(*jobs[id]));
+        }
+        return j;
+    }
+
+    // Short human readable summary
+    std::string getStatus()
+    {
+        const std::lock_guard<std::mutex> lock(mtx);
+        std::string status;
+        for (unsigned int id : running)
+        {
+            const ProverJob &job = *jobs[id];
+            status += status.empty() ? "" : "; ";
+            status += (job.stage == "proving") ? "Proving " : "Generating witness for ";
+            status += job.blockFilename.empty() ? "job " + std::to_string(job.id) : job.blockFilename;
+        }
+        if (status.empty())
+        {
+            status = "Idle";
+        }
+        if (!queued.empty())
+        {
+            status += " (" + std::to_string(queued.size()) + " queued)";
+        }
+        return status;
+    }
+
+  private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::condition_variable cvFinished;
+
+    unsigned int nextJobID;
+    bool stopped;
+    std::map<unsigned int, std::shared_ptr<ProverJob>> jobs;
+    std::deque<std::shared_ptr<ProverJob>> queued;
+    std::vector<unsigned int> running;
+    std::deque<unsigned int> finished;
+
+    void addFinished(const std::shared_ptr<ProverJob> &job)
+    {
+        finished.push_back(job->id);
+        while (finished.size() > MAX_FINISHED_JOBS)
+        {
+            jobs.erase(finished.front());
+            finished.pop_front();
+        }
+    }
+
+    static json toJSON(const ProverJob &job)
+    {
+        json j;
+        j["id"] = job.id;
+        j["status"] = toString(job.status);
+        j["block_filename"] = job.blockFilename;
+        j["proof_filename"] = job.proofFilename;
+        j["validate"] = job.validate;
+        if (!job.stage.empty())
+        {
+            j["stage"] = job.stage;
+        }
+        if (!job.error.empty())
+        {
+            j["error"] = job.error;
+        }
+        auto ms = [](decltype(now()) t1, decltype(now()) t2) {
+            return (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+        };
+        if (job.status != ProverJobStatus::Queued)
+        {
+            const auto &startedAt = (job.status == ProverJobStatus::Cancelled) ? job.finishedAt : job.startedAt;
+            j["wait_time_ms"] = ms(job.queuedAt, startedAt);
+        }
+        if (job.status == ProverJobStatus::Done || job.status == ProverJobStatus::Failed)
+        {
+            j["prove_time_ms"] = ms(job.startedAt, job.finishedAt);
+        }
+        return j;
+    }
+};
+
+// Generates the witness for the block. On failure `error` contains the reason.
+// When `validate` is set the block is pre-validated before the witness is generated and
+// afterwards all constraints are checked.
+bool generateBlockWitness(Loopring::Circuit *circuit, BlockInput &input, bool validate, std::string &error)
 {
-    std::ofstream fproof(proofFilename);
-    if (!fproof.is_open())
+    // Some checks to see if this block is compatible with the loaded circuit
+    if (/*input.blockType & circuit->getBlockType() != 1 || */ input.blockSize != circuit->getBlockSize())
     {
-        std::cerr << "Cannot create proof file: " << proofFilename << std::endl;
+        error = "Incompatible block requested! Use /info to check which blocks can be proven.";
         return false;
     }
-    fproof << jProof;
-    fproof.close();
-    std::cout << "Proof written to: " << proofFilename << std::endl;
-    return true;
-}
-
-Loopring::Circuit *newCircuit(unsigned int blockType, ethsnarks::ProtoboardT &outPb)
-{
-    return new Loopring::UniversalCircuit(outPb, "circuit");
-}
-
-Loopring::Circuit *createCircuit(unsigned int blockType, unsigned int blockSize, ethsnarks::ProtoboardT &outPb)
-{
-    std::cout << "Creating circuit... " << std::endl;
-    auto begin = now();
-    Loopring::Circuit *circuit = newCircuit(blockType, outPb);
-    circuit->generateConstraints(blockSize);
-    circuit->printInfo();
-    print_time(begin, "Circuit created");
-    return circuit;
-}
 
-bool generateWitness(Loopring::Circuit *circuit, const json &input)
-{
-    std::cout << "Generating witness... " << std::endl;
-    auto begin = now();
-    if (!circuit->generateWitness(input))
+    if (validate && !preValidateBlock(input, error))
     {
-        std::cerr << "Could not generate witness!" << std::endl;
         return false;
     }
-    print_time(begin, "Witness generated");
+    if (!generateWitness(circuit, input))
+    {
+        error = "Failed to generate witness for block!";
+        return false;
+    }
+    if (validate)
+    {
+        if (!validateCircuit(circuit, error))
+        {
+            error = "Block is invalid: " + error;
+            return false;
+        }
+    }
     return true;
 }
 
-bool validateCircuit(Loopring::Circuit *circuit)
+// Generates the proof for the witness currently stored in the circuit.
+// On failure `error` contains the reason.
+bool generateBlockProof(
+  ProverContextT &context,
+  Loopring::Circuit *circuit,
+  const std::string &proofFilename,
+  std::string &jProof,
+  std::string &error)
 {
-    std::cout << "Validating block..." << std::endl;
-    auto begin = now();
-    // Check if the inputs are valid for the circuit
-    if (!circuit->getPb().is_satisfied())
+    // All circuits share the same constraints, only the witness is different
+    context.constraint_system = &(circuit->getPb().constraint_system);
+    jProof = proveCircuit(context, circuit);
+    if (jProof.length() == 0)
     {
-        std::cerr << "Block is not valid!" << std::endl;
+        error = "Failed to prove block!";
         return false;
     }
-    print_time(begin, "Block is valid");
+    if (proofFilename.length() != 0)
+    {
+        if (!writeProof(jProof, proofFilename))
+        {
+            error = "Failed to write proof!";
+            return false;
+        }
+    }
     return true;
 }
 
-std::string getBaseName(unsigned int blockType)
+// Keeps the circuits and proving keys of multiple block sizes in memory.
+// Circuits are created on demand and the least recently used ones are unloaded
+// when the memory budget is exceeded.
+class CircuitPool
 {
-    switch (blockType)
+  public:
+    struct Entry
     {
-        default:
-            return "all";
+        unsigned int blockSize;
+        std::vector<std::unique_ptr<ethsnarks::ProtoboardT>> pbs;
+        std::vector<std::unique_ptr<Loopring::Circuit>> circuits;
+        // Circuits not in use by one of the pipeline stages
+        std::vector<Loopring::Circuit *> freeCircuits;
+        ProverContextT context;
+        size_t memoryUsage;
+        unsigned long lastUsed;
+    };
+
+    CircuitPool(
+      unsigned int _blockType,
+      const std::vector<unsigned int> &_blockSizes,
+      unsigned int _numCircuits,
+      size_t _memoryBudget,
+      const libsnark::Config &_config)
+        : blockType(_blockType),
+          blockSizes(_blockSizes),
+          numCircuits(_numCircuits),
+          memoryBudget(_memoryBudget),
+          config(_config),
+          useCounter(0)
+    {
+        std::sort(blockSizes.begin(), blockSizes.end());
     }
-}
 
-std::string getProvingKeyFilename(const std::string &baseFilename)
+    static std::string getBaseFilename(unsigned int blockType, unsigned int blockSize)
+    {
+        return "keys/" + getBaseName(blockType) + "_" + std::to_string(blockSize);
+    }
+
+    static std::string getProvingKeyFilename(unsigned int blockType, unsigned int blockSize)
+    {
+        return ::getProvingKeyFilename(getBaseFilename(blockType, blockSize));
+    }
+
+    bool isSupported(unsigned int blockSize) const
+    {
+        return std::find(blockSizes.begin(), blockSizes.end(), blockSize) != blockSizes.end();
+    }
+
+    // Returns a free circuit for the block size, loading the circuit if needed.
+    // Blocks until a circuit of this size is available.
+    Loopring::Circuit *acquire(unsigned int blockSize, Entry *&outEntry, std::string &error)
+    {
+        // The circuit has to match the block size exactly, the verification key
+        // used onchain is different for each block size.
+        if (!isSupported(blockSize))
+        {
+            error = "Incompatible block requested! Use /info to check which blocks can be proven.";
+            return nullptr;
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+        if (entries.find(blockSize) == entries.end())
+        {
+            std::string provingKeyFilename = getProvingKeyFilename(blockType, blockSize);
+            if (!fileExists(provingKeyFilename))
+            {
+                error = "Failed to find pk for block size " + std::to_string(blockSize) + "!";
+                return nullptr;
+            }
+            makeRoom(estimateMemoryUsage(blockSize));
+            // Loading takes a while, don't block the other stages (except the prover, see load).
+            // Only the witness stage acquires circuits so nothing else can load in the meantime.
+            lock.unlock();
+            std::unique_ptr<Entry> entry = load(blockSize, provingKeyFilename);
+            lock.lock();
+            knownMemoryUsage[blockSize] = entry->memoryUsage;
+            entries[blockSize] = std::move(entry);
+        }
+
+        Entry *entry = entries[blockSize].get();
+        cv.wait(lock, [entry] { return !entry->freeCircuits.empty(); });
+        Loopring::Circuit *circuit = entry->freeCircuits.back();
+        entry->freeCircuits.pop_back();
+        entry->lastUsed = ++useCounter;
+        outEntry = entry;
+        return circuit;
+    }
+
+    void release(Entry *entry, Loopring::Circuit *circuit)
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mtx);
+            entry->freeCircuits.push_back(circuit);
+        }
+        cv.notify_all();
+    }
+
+    std::string getInfo()
+    {
+        const std::lock_guard<std::mutex> lock(mtx);
+        std::string info = std::string("BlockType: ") + std::to_string(blockType) + "; BlockSizes:";
+        for (unsigned int blockSize : blockSizes)
+        {
+            info += " " + std::to_string(blockSize);
+        }
+        info += "; Loaded:";
+        for (const auto &entry : entries)
+        {
+            info += " " + std::to_string(entry.first) + " (" +
+                    std::to_string(entry.second->memoryUsage / (1024 * 1024)) + "MB)";
+        }
+        return info;
+    }
+
+    // Has to be held while proving, circuits are only loaded while no proof is generated
+    std::mutex &getProverMutex()
+    {
+        return proverMtx;
+    }
+
+  private:
+    unsigned int blockType;
+    std::vector<unsigned int> blockSizes;
+    unsigned int numCircuits;
+    size_t memoryBudget;
+    libsnark::Config config;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::mutex proverMtx;
+    std::map<unsigned int, std::unique_ptr<Entry>> entries;
+    std::map<unsigned int, size_t> knownMemoryUsage;
+    unsigned long useCounter;
+
+    size_t estimateMemoryUsage(unsigned int blockSize) const
+    {
+        auto it = knownMemoryUsage.find(blockSize);
+        if (it != knownMemoryUsage.end())
+        {
+            return it->second;
+        }
+        // Rough guess until the circuit was loaded once: the circuits take about
+        // as much memory as the proving key.
+        return 2 * getFileSize(getProvingKeyFilename(blockType, blockSize));
+    }
+
+    size_t getMemoryUsage() const
+    {
+        size_t total = 0;
+        for (const auto &entry : entries)
+        {
+            total += entry.second->memoryUsage;
+        }
+        return total;
+    }
+
+    // Unloads the least recently used idle circuits until the new circuit fits in the budget
+    void makeRoom(size_t required)
+    {
+        if (memoryBudget == 0)
+        {
+            return;
+        }
+        while (getMemoryUsage() + required > memoryBudget)
+        {
+            auto lru = entries.end();
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+            {
+                const Entry &entry = *(it->second);
+                bool idle = (entry.freeCircuits.size() == entry.circuits.size());
+                if (idle && (lru == entries.end() || entry.lastUsed < lru->second->lastUsed))
+                {
+                    lru = it;
+                }
+            }
+            if (lru == entries.end())
+            {
+                std::cout << "Memory budget exceeded, but all circuits are in use" << std::endl;
+                break;
+            }
+            std::cout << "Unloading circuit for block size " << lru->first << std::endl;
+            entries.erase(lru);
+#ifdef __GLIBC__
+            // Give the freed memory back to the system
+            malloc_trim(0);
+#endif
+        }
+    }
+
+    std::unique_ptr<Entry> load(unsigned int blockSize, const std::string &provingKeyFilename)
+    {
+        // Creating a circuit adds to the constants shared by all constraint systems (and
+        // reallocates them), which the prover reads. Waiting for the prover also keeps the
+        // memory of a running proof out of the memory usage of the circuit.
+        const std::lock_guard<std::mutex> proving(proverMtx);
+        std::cout << "Loading circuit for block size " << blockSize << "..." << std::endl;
+        size_t memoryBefore = getResidentMemory();
+
+        std::unique_ptr<Entry> entry(new Entry());
+        entry->blockSize = blockSize;
+        for (unsigned int i = 0; i < numCircuits; i++)
+        {
+            entry->pbs.emplace_back(new ethsnarks::ProtoboardT());
+            entry->circuits.emplace_back(
+              createCircuit(blockType, blockSize, *entry->pbs.back(), getBaseFilename(blockType, blockSize)));
+            entry->freeCircuits.push_back(entry->circuits.back().get());
+        }
+
+        ethsnarks::ProtoboardT &pb = entry->circuits.front()->getPb();
+        loadProvingKey(provingKeyFilename, entry->context.provingKey);
+        entry->context.constraint_system = &(pb.constraint_system);
+        entry->context.config = config;
+        entry->context.domain = get_domain(pb, entry->context.provingKey, config);
+        initProverContextBuffers(entry->context);
+
+        size_t memoryAfter = getResidentMemory();
+        entry->memoryUsage = (memoryAfter > memoryBefore) ? memoryAfter - memoryBefore
+                                                          : estimateMemoryUsage(blockSize);
+        entry->lastUsed = 0;
+        printMemoryUsage();
+        return entry;
+    }
+};
+
+bool parseJobID(const httplib::Request &req, unsigned int &id)
 {
-    return baseFilename + "_pk.raw";
+    std::string strID = req.get_param_value("id");
+    if (strID.length() == 0 || strID.find_first_not_of("0123456789") != std::string::npos)
+    {
+        return false;
+    }
+    id = std::stoul(strID);
+    return true;
 }
 
 void runServer(
-  Loopring::Circuit *circuit,
-  const std::string &provingKeyFilename,
+  unsigned int blockType,
+  const std::vector<unsigned int> &blockSizes,
   const libsnark::Config &config,
+  const ServerConfig &serverConfig,
   unsigned int port)
 {
     using namespace httplib;
 
-    struct ProverStatus
+    // With pipelining a second circuit is created for every block size so the witness of
+    // the next block can be generated while the current block is being proven.
+    CircuitPool circuitPool(
+      blockType,
+      blockSizes,
+      serverConfig.pipeline ? 2 : 1,
+      size_t(serverConfig.memoryBudgetMB) * 1024 * 1024,
+      config);
+    // Blocks with a witness ready to be proven
+    struct WitnessT
     {
-        bool proving = false;
-        std::string blockFilename;
-        std::string proofFilename;
+        std::shared_ptr<ProverJob> job;
+        Loopring::Circuit *circuit;
+        CircuitPool::Entry *entry;
     };
+    Loopring::BlockingQueue<WitnessT> witnesses;
 
-    struct ProverStatusRAII
-    {
-        ProverStatus &proverStatus;
-        ProverStatusRAII(
-          ProverStatus &_proverStatus,
-          const std::string &blockFilename,
-          const std::string &proofFilename)
-            : proverStatus(_proverStatus)
+    // Blocks waiting to be proven
+    ProverJobQueue jobQueue;
+    // Stage 1: witness generation
+    std::thread witnessGenerator([&]() {
+        while (std::shared_ptr<ProverJob> job = jobQueue.next())
         {
-            proverStatus.proving = true;
-            proverStatus.blockFilename = blockFilename;
-            proverStatus.proofFilename = proofFilename;
+            std::cout << "Generating witness for job " << job->id << ": " << job->blockFilename << std::endl;
+            std::string error;
+            CircuitPool::Entry *entry = nullptr;
+            Loopring::Circuit *circuit = nullptr;
+            bool success = false;
+            // A job that throws fails on its own, the server keeps running
+            try
+            {
+                std::shared_ptr<BlockInput> block = std::move(job->block);
+                BlockInput input;
+                if (block)
+                {
+                    input = std::move(*block);
+                    block.reset();
+                }
+                else if (!loadBlockInput(job->blockFilename, input, error))
+                {
+                    throw std::runtime_error(error);
+                }
+                circuit = circuitPool.acquire(input.blockSize, entry, error);
+                if (!circuit)
+                {
+                    throw std::runtime_error(error);
+                }
+                success = generateBlockWitness(circuit, input, job->validate, error);
+            }
+            catch (const std::exception &e)
+            {
+                error = e.what();
+            }
+            catch (...)
+            {
+                error = "Unknown error";
+            }
+            if (!success)
+            {
+                std::cerr << "Job " << job->id << " failed: " << error << std::endl;
+                jobQueue.finish(job, "", error);
+                if (circuit)
+                {
+                    circuitPool.release(entry, circuit);
+                }
+                continue;
+            }
+            jobQueue.setStage(job, "proving");
+            witnesses.push(WitnessT{job, circuit, entry});
         }
-
-        ~ProverStatusRAII()
+        witnesses.close();
+    });
+    // Stage 2: proof generation
+    std::thread prover([&]() {
+        WitnessT witness;
+        while (witnesses.pop(witness))
         {
-            proverStatus.proving = false;
+            const std::shared_ptr<ProverJob> &job = witness.job;
+            std::cout << "Proving job " << job->id << ": " << job->blockFilename << std::endl;
+            std::string jProof;
+            std::string error;
+            bool success = false;
+            try
+            {
+                const std::lock_guard<std::mutex> proving(circuitPool.getProverMutex());
+                success = generateBlockProof(witness.entry->context, witness.circuit, job->proofFilename, jProof, error);
+            }
+            catch (const std::exception &e)
+            {
+                error = e.what();
+            }
+            catch (...)
+            {
+                error = "Unknown error";
+            }
+            if (!success)
+            {
+                std::cerr << "Job " << job->id << " failed: " << error << std::endl;
+                jProof.clear();
+            }
+            jobQueue.finish(job, jProof, error);
+            circuitPool.release(witness.entry, witness.circuit);
         }
-    };
-
-    // Setup the context a single time
-    ProverContextT context;
-    loadProvingKey(provingKeyFilename, context.provingKey);
-    context.constraint_system = &(circuit->getPb().constraint_system);
-    context.config = config;
-    context.domain = get_domain(circuit->getPb(), context.provingKey, config);
-    initProverContextBuffers(context);
+    });
 
-    // Prover status info
-    ProverStatus proverStatus;
-    // Lock for the prover
-    std::mutex mtx;
     // Setup the server
     Server svr;
-    // Called to prove blocks
+    // Called to prove blocks, returns the job ID immediately
     svr.Get("/prove", [&](const Request &req, Response &res) {
-        const std::lock_guard<std::mutex> lock(mtx);
-
         // Parse the parameters
         std::string blockFilename = req.get_param_value("block_filename");
         std::string proofFilename = req.get_param_value("proof_filename");
@@ -420,80 +1536,109 @@ void runServer(
             return;
         }
 
-        // Set the prover status for this session
-        ProverStatusRAII statusRAII(proverStatus, blockFilename, proofFilename);
-
-        // Prove the block
-        json input = loadJSON(blockFilename);
-        if (input == json())
+        unsigned int id;
+        if (!jobQueue.add(blockFilename, nullptr, proofFilename, validate, id))
         {
-            res.set_content("Error: Failed to load block!\n", "text/plain");
+            res.status = 503;
+            res.set_content("Error: The server is stopping!\n", "text/plain");
             return;
         }
-
-        // Some checks to see if this block is compatible with the loaded circuit
-        int iBlockType = input["blockType"].get<int>();
-        unsigned int blockSize = input["blockSize"].get<int>();
-        if (/*iBlockType & circuit->getBlockType() != 1 || */ blockSize != circuit->getBlockSize())
+        json j;
+        j["id"] = id;
+        res.set_content(j.dump() + "\n", "application/json");
+    });
+    // Called to prove a block sent in the request body, returns the proof when done
+    svr.Post("/prove", [&](const Request &req, Response &res, const ContentReader &contentReader) {
+        std::string proofFilename = req.get_param_value("proof_filename");
+        std::string strValidate = req.get_param_value("validate");
+        bool validate = (strValidate.compare("true") == 0) ? true : false;
+        bool async = (req.get_param_value("async").compare("true") == 0) ? true : false;
+
+        std::string body;
+        contentReader([&](const char *data, size_t length) {
+            body.append(data, length);
+            return true;
+        });
+        std::shared_ptr<BlockInput> block = std::make_shared<BlockInput>();
+        std::string error;
+        if (!parseBlockInput(body, *block, error))
         {
-            res.set_content(
-              "Error: Incompatible block requested! Use /info to check "
-              "which blocks can be proven.\n",
-              "text/plain");
+            res.status = 400;
+            res.set_content("Error: " + error + "\n", "text/plain");
             return;
         }
 
-        if (!generateWitness(circuit, input))
+        unsigned int id;
+        if (!jobQueue.add("", block, proofFilename, validate, id))
         {
-            res.set_content("Error: Failed to generate witness for block!\n", "text/plain");
+            res.status = 503;
+            res.set_content("Error: The server is stopping!\n", "text/plain");
             return;
         }
-        if (validate)
+        block.reset();
+        if (async)
         {
-            if (!validateCircuit(circuit))
-            {
-                res.set_content("Error: Block is invalid!\n", "text/plain");
-                return;
-            }
+            json j;
+            j["id"] = id;
+            res.set_content(j.dump() + "\n", "application/json");
+            return;
         }
-        std::string jProof = proveCircuit(context, circuit);
-        if (jProof.length() == 0)
+        std::string jProof;
+        if (!jobQueue.wait(id, jProof, error))
         {
-            res.set_content("Error: Failed to prove block!\n", "text/plain");
+            res.status = 500;
+            res.set_content("Error: " + error + "\n", "text/plain");
             return;
         }
-        if (proofFilename.length() != 0)
+        res.set_header("Job-Id", std::to_string(id).c_str());
+        res.set_content(jProof + "\n", "application/json");
+    });
+    // Returns the state of a single job
+    svr.Get("/job", [&](const Request &req, Response &res) {
+        unsigned int id;
+        json j;
+        if (!parseJobID(req, id) || (j = jobQueue.getJob(id)) == json())
         {
-            if (!writeProof(jProof, proofFilename))
-            {
-                res.set_content("Error: Failed to write proof!\n", "text/plain");
-                return;
-            }
+            res.status = 404;
+            res.set_content("Error: Unknown job!\n", "text/plain");
+            return;
         }
-        // Return the proof
-        res.set_content(jProof + "\n", "text/plain");
+        res.set_content(j.dump() + "\n", "application/json");
     });
-    // Retuns the status of the server
-    svr.Get("/status", [&](const Request &req, Response &res) {
-        if (proverStatus.proving)
+    // Returns the proof of a finished job
+    svr.Get("/proof", [&](const Request &req, Response &res) {
+        unsigned int id;
+        if (!parseJobID(req, id))
         {
-            std::string status = std::string("Proving ") + proverStatus.blockFilename;
-            res.set_content(status + "\n", "text/plain");
+            res.status = 404;
+            res.set_content("Error: Unknown job!\n", "text/plain");
+            return;
         }
-        else
+        std::string jProof;
+        std::string error;
+        if (!jobQueue.getProof(id, jProof, error))
         {
-            res.set_content("Idle\n", "text/plain");
+            res.status = 404;
+            res.set_content("Error: " + error + "\n", "text/plain");
+            return;
         }
+        res.set_content(jProof + "\n", "text/plain");
+    });
+    // Lists all queued, running and finished jobs
+    svr.Get("/jobs", [&](const Request &req, Response &res) {
+        res.set_content(jobQueue.getJobs().dump() + "\n", "application/json");
+    });
+    // Retuns the status of the server
+    svr.Get("/status", [&](const Request &req, Response &res) {
+        res.set_content(jobQueue.getStatus() + "\n", "text/plain");
     });
     // Info of this prover server
     svr.Get("/info", [&](const Request &req, Response &res) {
-        std::string info = std::string("BlockType: ") + std::to_string(int(circuit->getBlockType())) +
-                           std::string("; BlockSize: ") + std::to_string(circuit->getBlockSize()) + "\n";
-        res.set_content(info, "text/plain");
+        res.set_content(circuitPool.getInfo() + "\n", "text/plain");
     });
     // Stops the prover server
     svr.Get("/stop", [&](const Request &req, Response &res) {
-        const std::lock_guard<std::mutex> lock(mtx);
+        jobQueue.stop();
         svr.stop();
     });
     // Default page contains help
@@ -502,16 +1647,28 @@ void runServer(
         content += "Prover server:\n";
         content += "- Prove a block: "
                    "/prove?block_filename=<block.json>&proof_filename=<proof.json>&"
-                   "validate=true (proof_filename and validate are optional)\n";
+                   "validate=true (proof_filename and validate are optional). "
+                   "Queues the block and returns the job id.\n";
+        content += "- Prove a block sent in the body (json or the binary block format): "
+                   "POST /prove?proof_filename=<proof.json>&validate=true&async=true (all optional). "
+                   "Returns the proof when done, or the job id immediately with async=true.\n";
+        content += "- Status of a job: /job?id=<id>\n";
+        content += "- Proof of a finished job: /proof?id=<id>\n";
+        content += "- List all queued, running and finished jobs: /jobs\n";
         content += "- Status of the server: /status (busy proving a block or not)\n";
         content += "- Info of the server: /info (which blocks can be proven)\n";
         content += "- Shut down the server: /stop (will first finish generating "
-                   "the proof if busy)\n";
+                   "the proof if busy, queued blocks are cancelled)\n";
         res.set_content(content, "text/plain");
     });
 
     std::cout << "Running server on 'localhost' on port " << port << std::endl;
     svr.listen("127.0.0.1", port);
+
+    // Make sure the pipeline is stopped before the circuits are destroyed
+    jobQueue.stop();
+    witnessGenerator.join();
+    prover.join();
 }
 
 bool runBenchmark(Loopring::Circuit *circuit, const std::string &provingKeyFilename)
@@ -524,7 +1681,8 @@ bool runBenchmark(Loopring::Circuit *circuit, const std::string &provingKeyFilen
     VerificationKeyT vk =
       loadVerificationKey(provingKeyFilename.substr(0, provingKeyFilename.length() - 6) + "vk.json");
 
-    if (!validateCircuit(circuit))
+    std::string error;
+    if (!validateCircuit(circuit, error))
     {
         return false;
     }
@@ -646,6 +1804,7 @@ int main(int argc, char **argv)
     // Load in the config
     libsnark::Config config = loadConfig("config.json");
     std::cout << "Config: " << config << std::endl;
+    ServerConfig serverConfig = loadServerConfig("config.json");
 
 #ifdef MULTICORE
     // omp_set_nested is needed for gcc for some reason
@@ -683,6 +1842,12 @@ int main(int argc, char **argv)
         std::cerr << "-benchmark <block.json>: Try out multiple prover options to "
                      "find the fastest configuration on the system"
                   << std::endl;
+        std::cerr << "-profile <block.json> <profile.json>: Writes the number of constraints, "
+                     "variables and terms used by every gadget to json"
+                  << std::endl;
+        std::cerr << "-convertblock <block.json> <block.bin>: Converts a block to the binary "
+                     "block format, which can be used everywhere a block is expected"
+                  << std::endl;
         return 1;
     }
 
@@ -740,6 +1905,16 @@ int main(int argc, char **argv)
         mode = Mode::ExportCircuit;
         std::cout << "Exporting circuit for " << argv[2] << "..." << std::endl;
     }
+    else if (strcmp(argv[1], "-profile") == 0)
+    {
+        if (argc != 4)
+        {
+            std::cout << "Invalid number of arguments!" << std::endl;
+            return 1;
+        }
+        mode = Mode::Profile;
+        std::cout << "Profiling circuit for " << argv[2] << "..." << std::endl;
+    }
     else if (strcmp(argv[1], "-exportwitness") == 0)
     {
         if (argc != 4)
@@ -797,6 +1972,21 @@ int main(int argc, char **argv)
         std::cout << "Successfully created pk " << argv[3] << "." << std::endl;
         return 0;
     }
+    else if (strcmp(argv[1], "-convertblock") == 0)
+    {
+        if (argc != 4)
+        {
+            std::cout << "Invalid number of arguments!" << std::endl;
+            return 1;
+        }
+        std::cout << "Converting block " << argv[2] << " to " << argv[3] << " ..." << std::endl;
+        if (!convertBlock(argv[2], argv[3]))
+        {
+            return 1;
+        }
+        std::cout << "Successfully created block " << argv[3] << "." << std::endl;
+        return 0;
+    }
     else if (strcmp(argv[1], "-server") == 0)
     {
         if (argc != 4)
@@ -824,15 +2014,17 @@ int main(int argc, char **argv)
     }
 
     // Read the block file
-    json input = loadJSON(argv[2]);
-    if (input == json())
+    BlockInput input;
+    std::string error;
+    if (!loadBlockInput(argv[2], input, error))
     {
+        std::cerr << error << std::endl;
         return 1;
     }
 
     // Read meta data
-    int iBlockType = input["blockType"].get<int>();
-    unsigned int blockSize = input["blockSize"].get<int>();
+    int iBlockType = input.blockType;
+    unsigned int blockSize = input.blockSize;
     std::string postFix = "_" + std::to_string(blockSize);
 
     /*if (iBlockType >= int(Loopring::BlockType::COUNT))
@@ -853,15 +2045,40 @@ int main(int argc, char **argv)
         }
     }
 
+    if (mode == Mode::Server)
+    {
+#ifdef MULTICORE
+        omp_set_num_threads(config.num_threads);
+        std::cout << "Num threads used: " << omp_get_max_threads() << std::endl;
+#endif
+        std::vector<unsigned int> blockSizes = serverConfig.blockSizes;
+        if (blockSizes.empty())
+        {
+            blockSizes.push_back(blockSize);
+        }
+        runServer(blockType, blockSizes, config, serverConfig, std::stoi(argv[3]));
+        return 0;
+    }
+
+    // Collect the cost of all gadgets while the constraints are generated
+    Loopring::CircuitProfiler profiler;
+    if (mode == Mode::Profile)
+    {
+        Loopring::CircuitProfiler::getActive() = &profiler;
+    }
+
     ethsnarks::ProtoboardT pb;
-    Loopring::Circuit *circuit = createCircuit(blockType, blockSize, pb);
+    // The constraints are always generated when creating new keys or profiling
+    bool useCache = (mode != Mode::CreateKeys && mode != Mode::Profile);
+    // Validating only needs the witness, the cached constraints are checked directly
+    Loopring::FlatConstraintSystem constraintSystem;
+    Loopring::Circuit *circuit = createCircuit(
+      blockType, blockSize, pb, useCache ? baseFilename : "", (mode == Mode::Validate) ? &constraintSystem : nullptr);
+    Loopring::CircuitProfiler::getActive() = nullptr;
     if (config.swapAB)
     {
         // pb.constraint_system.swap_AB_if_beneficial();
     }
-    pb.constraint_system.constraints.shrink_to_fit();
-    pb.values.shrink_to_fit();
-    libsnark::ConstantStorage<FieldT>::getInstance().constants.shrink_to_fit();
 
     printMemoryUsage();
 
@@ -891,13 +2108,16 @@ int main(int argc, char **argv)
     std::cout << "Num threads used: " << omp_get_max_threads() << std::endl;
 #endif
 
-    if (mode == Mode::Server)
-    {
-        runServer(circuit, provingKeyFilename, config, std::stoi(argv[3]));
-    }
-
     if (mode == Mode::Validate || mode == Mode::Prove)
     {
+        // Pre-validation needs the complete block, so it is only done when validating.
+        // When proving the block is streamed while the witness is generated.
+        std::string error;
+        if (mode == Mode::Validate && !preValidateBlock(input, error))
+        {
+            std::cerr << error << std::endl;
+            return 1;
+        }
         if (!generateWitness(circuit, input))
         {
             return 1;
@@ -906,7 +2126,8 @@ int main(int argc, char **argv)
 
     if (mode == Mode::Validate || mode == Mode::Prove)
     {
-        if (!validateCircuit(circuit))
+        std::string error;
+        if (!validateCircuit(circuit, error, constraintSystem.isLoaded() ? &constraintSystem : nullptr))
         {
             return 1;
         }
@@ -919,6 +2140,10 @@ int main(int argc, char **argv)
             std::cerr << "Failed to generate keys!" << std::endl;
             return 1;
         }
+        if (!writeConstraintSystemCache(pb, baseFilename))
+        {
+            return 1;
+        }
     }
 
     if (mode == Mode::Prove)
@@ -949,6 +2174,14 @@ int main(int argc, char **argv)
 #endif
     }
 
+    if (mode == Mode::Profile)
+    {
+        if (!writeProfile(profiler, pb, argv[3]))
+        {
+            return 1;
+        }
+    }
+
     if (mode == Mode::ExportCircuit)
     {
         if (!r1cs2json(pb, argv[3]))
@@ -0,0 +1,59 @@
+#include "../ThirdParty/catch.hpp"
+#include "TestUtils.h"
+
+#include "../Utils/BinaryBlock.h"
+
+TEST_CASE("BinaryBlock", "[BinaryBlock]")
+{
+    Block block = getBlock();
+    std::string data = BinaryBlock::encode(0, block.transactions.size(), block);
+    REQUIRE(BinaryBlock::isBinary(data.data(), data.size()));
+
+    SECTION("Round trip")
+    {
+        unsigned int blockType = 1;
+        unsigned int blockSize = 0;
+        Block decoded;
+        std::string error;
+        REQUIRE(BinaryBlock::decode(data.data(), data.size(), blockType, blockSize, decoded, error));
+        REQUIRE(blockType == 0);
+        REQUIRE(blockSize == block.transactions.size());
+        REQUIRE(decoded.transactions.size() == block.transactions.size());
+        REQUIRE(decoded.merkleRootBefore == block.merkleRootBefore);
+        REQUIRE(decoded.signature.R.x == block.signature.R.x);
+
+        const Witness &witness = decoded.transactions[2].witness;
+        const Witness &expectedWitness = block.transactions[2].witness;
+        REQUIRE(witness.accountUpdate_A.proof.getValues() == expectedWitness.accountUpdate_A.proof.getValues());
+        REQUIRE(witness.balanceUpdateS_A.after.balance == expectedWitness.balanceUpdateS_A.after.balance);
+        REQUIRE(decoded.transactions[2].type == block.transactions[2].type);
+        REQUIRE(decoded.transactions[2].spotTrade->orderA.amountS == block.transactions[2].spotTrade->orderA.amountS);
+
+        REQUIRE(BinaryBlock::encode(blockType, blockSize, decoded) == data);
+    }
+
+    SECTION("Truncated")
+    {
+        unsigned int blockType = 0;
+        unsigned int blockSize = 0;
+        Block decoded;
+        std::string error;
+        REQUIRE(!BinaryBlock::decode(data.data(), data.size() - 1, blockType, blockSize, decoded, error));
+        REQUIRE(!error.empty());
+    }
+
+    SECTION("Field element out of range")
+    {
+        // The first field element (the exchange) is right after the header
+        std::string invalid = data;
+        for (unsigned int i = 0; i < FieldT::num_limbs * 8; i++)
+        {
+            invalid[BinaryBlock::HEADER_SIZE + i] = char(0xff);
+        }
+        unsigned int blockType = 0;
+        unsigned int blockSize = 0;
+        Block decoded;
+        std::string error;
+        REQUIRE(!BinaryBlock::decode(invalid.data(), invalid.size(), blockType, blockSize, decoded, error));
+    }
+}
@@ -0,0 +1,174 @@
+#include "../ThirdParty/catch.hpp"
+#include "TestUtils.h"
+
+#include "../Utils/BinaryBlock.h"
+#include "../Utils/BlockDecoder.h"
+
+TEST_CASE("BlockDecoder", "[BlockDecoder]")
+{
+    SECTION("Same as the json conversion")
+    {
+        Block block = getBlock();
+
+        ifstream file(string(TEST_DATA_PATH) + "block.json");
+        REQUIRE(file.is_open());
+        Block decoded;
+        BlockDecoder decoder(decoded);
+        REQUIRE(decoder.decode(file));
+        REQUIRE(decoded.transactions.size() == block.transactions.size());
+        REQUIRE(decoded.transactions[2].type == block.transactions[2].type);
+        // Only the data of the transaction type is stored
+        REQUIRE(decoded.transactions[2].spotTrade);
+        REQUIRE(!decoded.transactions[2].transfer);
+        // All proofs share the same proof values
+        const Proof &proof = decoded.transactions[0].witness.accountUpdate_A.proof;
+        REQUIRE(proof.table == decoded.transactions[1].witness.balanceUpdateS_B.proof.table);
+        REQUIRE(proof.table->size() < proof.size() * decoded.transactions.size());
+        REQUIRE(BinaryBlock::encode(0, 0, decoded) == BinaryBlock::encode(0, 0, block));
+    }
+
+    SECTION("Invalid transaction in the json conversion")
+    {
+        ifstream file(string(TEST_DATA_PATH) + "block.json");
+        REQUIRE(file.is_open());
+        json input;
+        file >> input;
+        input["transactions"][1].erase("witness");
+        input["transactions"][5].erase("witness");
+
+        Block block;
+        REQUIRE_THROWS_WITH(
+          from_json(input, block), Catch::Contains("transaction 1:") && Catch::Contains("transaction 5:"));
+    }
+
+    SECTION("Streaming")
+    {
+        Block block = getBlock();
+
+        ifstream file(string(TEST_DATA_PATH) + "block.json");
+        REQUIRE(file.is_open());
+        json input;
+        file >> input;
+        // The keys are sorted, so the transactions come after all other block data
+        std::string data = input.dump();
+
+        Block decoded;
+        BlockDecoder decoder(decoded);
+        unsigned int numHeaders = 0;
+        decoder.stream(
+          [&](const Block &header) {
+              numHeaders++;
+              REQUIRE(header.merkleRootBefore == block.merkleRootBefore);
+              return true;
+          },
+          [&](UniversalTransaction &transaction) {
+              decoded.transactions.push_back(std::move(transaction));
+              return true;
+          });
+        REQUIRE(decoder.decode(data));
+        REQUIRE(decoder.isStreaming());
+        REQUIRE(numHeaders == 1);
+        REQUIRE(decoded.transactions.size() == block.transactions.size());
+        REQUIRE(BinaryBlock::encode(0, 0, decoded) == BinaryBlock::encode(0, 0, block));
+
+        // Stops when the transaction handler fails
+        Block stopped;
+        BlockDecoder failingDecoder(stopped);
+        failingDecoder.stream(
+          [](const Block &) { return true; }, [](UniversalTransaction &) { return false; });
+        REQUIRE(!failingDecoder.decode(data));
+        REQUIRE(!failingDecoder.getError().empty());
+    }
+
+    SECTION("Converted on worker threads")
+    {
+        Block block = getBlock();
+
+        ifstream file(string(TEST_DATA_PATH) + "block.json");
+        REQUIRE(file.is_open());
+        json input;
+        file >> input;
+        std::string data = input.dump();
+
+        for (unsigned int numWorkers : {0, 1, 3})
+        {
+            Block decoded;
+            BlockDecoder decoder(decoded);
+            decoder.setNumWorkers(numWorkers);
+            REQUIRE(decoder.decode(data));
+            REQUIRE(BinaryBlock::encode(0, 0, decoded) == BinaryBlock::encode(0, 0, block));
+
+            // The transactions are still passed on in order
+            Block streamed;
+            BlockDecoder streamingDecoder(streamed);
+            streamingDecoder.setNumWorkers(numWorkers);
+            streamingDecoder.stream(
+              [](const Block &) { return true; },
+              [&](UniversalTransaction &transaction) {
+                  streamed.transactions.push_back(std::move(transaction));
+                  return true;
+              });
+            REQUIRE(streamingDecoder.decode(data));
+            REQUIRE(streamingDecoder.isStreaming());
+            decoded.transactions = streamed.transactions;
+            REQUIRE(BinaryBlock::encode(0, 0, decoded) == BinaryBlock::encode(0, 0, block));
+        }
+    }
+
+    SECTION("Streaming needs the block data before the transactions")
+    {
+        ifstream file(string(TEST_DATA_PATH) + "block.json");
+        REQUIRE(file.is_open());
+        Block decoded;
+        BlockDecoder decoder(decoded);
+        unsigned int numTransactions = 0;
+        decoder.stream(
+          [](const Block &) { return true; },
+          [&](UniversalTransaction &) {
+              numTransactions++;
+              return true;
+          });
+        REQUIRE(decoder.decode(file));
+        REQUIRE(!decoder.isStreaming());
+        REQUIRE(numTransactions == 0);
+        REQUIRE(decoded.transactions.size() == getBlock().transactions.size());
+    }
+
+    SECTION("Header only")
+    {
+        ifstream file(string(TEST_DATA_PATH) + "block.json");
+        REQUIRE(file.is_open());
+        Block decoded;
+        BlockDecoder decoder(decoded);
+        decoder.headerOnly();
+        REQUIRE(decoder.decode(file));
+        REQUIRE(decoder.getBlockSize() == getBlock().transactions.size());
+        REQUIRE(decoded.transactions.size() == 0);
+    }
+
+    SECTION("Block without transactions")
+    {
+        Block decoded;
+        BlockDecoder decoder(decoded);
+        REQUIRE(decoder.decode(std::string("{\"blockType\": 0, \"blockSize\": 16}")));
+        REQUIRE(decoder.getBlockType() == 0);
+        REQUIRE(decoder.getBlockSize() == 16);
+        REQUIRE(decoded.transactions.size() == 0);
+    }
+
+    SECTION("Invalid json")
+    {
+        Block decoded;
+        BlockDecoder decoder(decoded);
+        REQUIRE(!decoder.decode(std::string("{\"blockSize\": 1, \"transactions\": [{")));
+        REQUIRE(!decoder.getError().empty());
+    }
+
+    SECTION("Not an object")
+    {
+        Block decoded;
+        BlockDecoder decoder(decoded);
+        REQUIRE(!decoder.decode(std::string("[]")));
+        REQUIRE(!decoder.getError().empty());
+    }
+}
@@ -0,0 +1,52 @@
+#include "../ThirdParty/catch.hpp"
+#include "TestUtils.h"
+
+#include "../Utils/BlockValidator.h"
+
+TEST_CASE("BlockValidator", "[BlockValidator]")
+{
+    Block block = getBlock();
+    std::string error;
+
+    SECTION("Valid block")
+    {
+        REQUIRE(BlockValidator(block).validate(error));
+        REQUIRE(error.empty());
+    }
+
+    SECTION("Invalid balance")
+    {
+        BalanceLeaf &leaf = block.transactions[3].witness.balanceUpdateS_A.after;
+        leaf.balance = leaf.balance + FieldT::one();
+        REQUIRE(!BlockValidator(block).validate(error));
+        REQUIRE(error == "Transaction 3: balanceUpdateS_A: the root after does not match the leaf and the proof");
+    }
+
+    SECTION("Invalid root")
+    {
+        block.transactions[2].witness.accountUpdate_B.rootAfter = 5;
+        REQUIRE(!BlockValidator(block).validate(error));
+        REQUIRE(error == "Transaction 2: accountUpdate_B: the root after does not match the leaf and the proof");
+    }
+
+    SECTION("Invalid merkleRootAfter")
+    {
+        block.merkleRootAfter = 5;
+        REQUIRE(!BlockValidator(block).validate(error));
+        REQUIRE(error == "merkleRootAfter does not match");
+    }
+
+    SECTION("Invalid signature")
+    {
+        block.transactions[1].witness.signatureA.R.x = 5;
+        REQUIRE(!BlockValidator(block).validate(error));
+        REQUIRE(error == "Transaction 1: Invalid signatureA");
+    }
+
+    SECTION("Invalid timestamp")
+    {
+        block.timestamp = FieldT("4294967296");
+        REQUIRE(!BlockValidator(block).validate(error));
+        REQUIRE(error == "Invalid timestamp");
+    }
+}
@@ -0,0 +1,139 @@
+#include "../ThirdParty/catch.hpp"
+#include "TestUtils.h"
+
+#include "../Gadgets/MathGadgets.h"
+#include "../Utils/ConstraintSystem.h"
+
+TEST_CASE("FlatConstraintSystem", "[FlatConstraintSystem]")
+{
+    unsigned int n = 96;
+    FieldT value = getRandomFieldElement(n);
+    FieldT numerator = getRandomFieldElement(n);
+    FieldT denominator = getRandomFieldElement(n) + FieldT::one();
+
+    protoboard<FieldT> pb;
+    {
+        pb_variable<FieldT> a = make_variable(pb, value, "value");
+        pb_variable<FieldT> b = make_variable(pb, numerator, "numerator");
+        pb_variable<FieldT> c = make_variable(pb, denominator, "denominator");
+        Constants constants(pb, "constants");
+        MulDivGadget mulDivGadget(pb, constants, a, b, c, n, n, n + 1, "mulDivGadget");
+        constants.generate_r1cs_constraints();
+        mulDivGadget.generate_r1cs_constraints();
+        mulDivGadget.generate_r1cs_witness();
+        REQUIRE(pb.is_satisfied());
+    }
+
+    const std::string filename = "./constraint_system_test.raw";
+    {
+        FlatConstraintSystem cs;
+        cs.build(pb, 123);
+        REQUIRE(cs.getHeader().numConstraints == pb.num_constraints());
+        REQUIRE(cs.getHeader().numVariables == pb.num_variables());
+        REQUIRE(cs.write(filename));
+    }
+
+    SECTION("Load")
+    {
+        FlatConstraintSystem cs;
+        REQUIRE(cs.load(filename));
+        REQUIRE(cs.getHeader().keyFingerprint == 123);
+
+        // Only allocate the variables, the constraints come from the cache
+        protoboard<FieldT> pbCached;
+        pb_variable<FieldT> a = make_variable(pbCached, value, "value");
+        pb_variable<FieldT> b = make_variable(pbCached, numerator, "numerator");
+        pb_variable<FieldT> c = make_variable(pbCached, denominator, "denominator");
+        Constants constants(pbCached, "constants");
+        MulDivGadget mulDivGadget(pbCached, constants, a, b, c, n, n, n + 1, "mulDivGadget");
+        REQUIRE(pbCached.num_constraints() == 0);
+        cs.addTo(pbCached);
+        REQUIRE(pbCached.num_constraints() == pb.num_constraints());
+
+        mulDivGadget.generate_r1cs_witness();
+        REQUIRE(pbCached.is_satisfied());
+        REQUIRE(cs.isSatisfied(pbCached));
+
+        uint64_t unsatisfied = 0;
+        REQUIRE(isSatisfied(pbCached, &unsatisfied));
+        REQUIRE(unsatisfied == pbCached.num_constraints());
+
+        pbCached.val(mulDivGadget.quotient) -= FieldT::one();
+        REQUIRE(!pbCached.is_satisfied());
+        REQUIRE(!cs.isSatisfied(pbCached));
+
+        // The first unsatisfied constraint is found, no matter the order the chunks are checked
+        uint64_t expected = 0;
+        while (cs.evaluate(0, expected, pbCached.values) * cs.evaluate(1, expected, pbCached.values) ==
+               cs.evaluate(2, expected, pbCached.values))
+        {
+            expected++;
+        }
+        REQUIRE(!cs.isSatisfied(pbCached, &unsatisfied));
+        REQUIRE(unsatisfied == expected);
+        REQUIRE(!isSatisfied(pbCached, &unsatisfied));
+        REQUIRE(unsatisfied == expected);
+        REQUIRE(cs.getMaxVariable(expected) == getMaxVariable(pbCached, expected));
+        REQUIRE(cs.getMaxVariable(expected) >= mulDivGadget.quotient.index);
+    }
+
+    SECTION("Corrupted")
+    {
+        {
+            std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekg(-1, std::ios::end);
+            char c = file.get();
+            file.seekp(-1, std::ios::end);
+            file.put(c ^ 1);
+        }
+        FlatConstraintSystem cs;
+        REQUIRE(!cs.load(filename));
+    }
+
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("findUnsatisfiedConstraint", "[FlatConstraintSystem]")
+{
+    const uint64_t numConstraints = 100000;
+    REQUIRE(findUnsatisfiedConstraint(numConstraints, [](uint64_t) { return true; }) == numConstraints);
+    for (uint64_t first : {uint64_t(0), uint64_t(1023), uint64_t(1024), uint64_t(54321), numConstraints - 1})
+    {
+        // Many constraints after the first one fail as well
+        auto satisfied = [&](uint64_t i) { return i < first || (i != first && i % 3 != 0); };
+        REQUIRE(findUnsatisfiedConstraint(numConstraints, satisfied) == first);
+    }
+}
+
+TEST_CASE("hashFile", "[FlatConstraintSystem]")
+{
+    const std::string filename = "./hash_file_test.raw";
+    // Larger than a couple of chunks and not a whole number of words
+    std::vector<char> data(3 * 1024 * 1024 + 5);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = char(i * 7 + 3);
+    }
+    auto write = [&]() {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), data.size());
+    };
+
+    write();
+    const uint64_t hash = FlatConstraintSystem::hashFile(filename);
+    REQUIRE(hash != 0);
+    REQUIRE(FlatConstraintSystem::hashFile(filename) == hash);
+
+    // Every byte is part of the hash, also the ones in the middle of the file
+    data[data.size() / 2] ^= 1;
+    write();
+    REQUIRE(FlatConstraintSystem::hashFile(filename) != hash);
+    data[data.size() / 2] ^= 1;
+
+    data.push_back(0);
+    write();
+    REQUIRE(FlatConstraintSystem::hashFile(filename) != hash);
+
+    std::remove(filename.c_str());
+    REQUIRE(FlatConstraintSystem::hashFile(filename) == 0);
+}
@@ -120,7 +120,7 @@ TEST_CASE("Float", "[FloatGadget]")
                 unsigned int f = toFloat(_value, encoding);
                 floatGadget.generate_r1cs_witness(f);
 
-                FieldT rValue = toFieldElement(fromFloat(f, encoding));
+                FieldT rValue = fromFloat(f, encoding);
                 REQUIRE(pb.is_satisfied());
                 REQUIRE((pb.val(floatGadget.value()) == rValue));
                 REQUIRE(compareBits(floatGadget.bits().get_bits(pb), toBits(f, numBitsFloat)));
@@ -235,7 +235,7 @@ TEST_CASE("RequireFillLimit", "[RequireFillLimitGadget]")
     Block block = getBlock();
     const UniversalTransaction &tx = getSpotTrade(block);
 
-    const Order &order = tx.spotTrade.orderA;
+    const Order &order = tx.getSpotTrade().orderA;
     const AccountLeaf &account = tx.witness.accountUpdate_A.before;
     const BalanceLeaf &balanceLeafS = tx.witness.balanceUpdateS_A.before;
     const BalanceLeaf &balanceLeafB = tx.witness.balanceUpdateB_A.before;
@@ -744,21 +744,21 @@ TEST_CASE("OrderMatching", "[OrderMatchingGadget]")
     const FieldT &exchange = block.exchange;
     const FieldT &timestamp = block.timestamp;
 
-    const Order &A_order = tx.spotTrade.orderA;
+    const Order &A_order = tx.getSpotTrade().orderA;
     const AccountLeaf &A_account = tx.witness.accountUpdate_A.before;
     const BalanceLeaf &A_balanceLeafS = tx.witness.balanceUpdateS_A.before;
     const BalanceLeaf &A_balanceLeafB = tx.witness.balanceUpdateB_A.before;
     const StorageLeaf &A_storageLeaf = tx.witness.storageUpdate_A.before;
     const OrderState orderStateA = {A_order, A_account, A_balanceLeafS, A_balanceLeafB, A_storageLeaf};
-    const FieldT expectFillS_A(fromFloat(tx.spotTrade.fillS_A.as_ulong(), Float24Encoding).to_string().c_str());
+    const FieldT expectFillS_A = fromFloat(tx.getSpotTrade().fillS_A.as_ulong(), Float24Encoding);
 
-    const Order &B_order = tx.spotTrade.orderB;
+    const Order &B_order = tx.getSpotTrade().orderB;
     const AccountLeaf &B_account = tx.witness.accountUpdate_B.before;
     const BalanceLeaf &B_balanceLeafS = tx.witness.balanceUpdateS_B.before;
     const BalanceLeaf &B_balanceLeafB = tx.witness.balanceUpdateB_B.before;
     const StorageLeaf &B_storageLeaf = tx.witness.storageUpdate_B.before;
     const OrderState orderStateB = {B_order, B_account, B_balanceLeafS, B_balanceLeafB, B_storageLeaf};
-    const FieldT expectFillS_B(fromFloat(tx.spotTrade.fillS_B.as_ulong(), Float24Encoding).to_string().c_str());
+    const FieldT expectFillS_B = fromFloat(tx.getSpotTrade().fillS_B.as_ulong(), Float24Encoding);
 
     unsigned int numStorageSlots = pow(2, NUM_BITS_STORAGE_ADDRESS);
     const FieldT A_storageID = rand() % numStorageSlots;
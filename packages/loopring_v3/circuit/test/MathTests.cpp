@@ -1831,3 +1831,56 @@ TEST_CASE("TokenTradeData", "[TokenTradeDataGadget]")
         tokenTradeDataChecked(NFT_TOKEN_ID_START+12, 123, NFT_TOKEN_ID_START+1233, 124, 0, 1, 123, false);
     }
 }
+
+TEST_CASE("UInt", "[UInt]")
+{
+    unsigned int numIterations = 64;
+    for (unsigned int i = 0; i < numIterations; i++)
+    {
+        const BigInt a = getRandomFieldElementAsBigInt();
+        const BigInt b = getRandomFieldElementAsBigInt(1 + (i * 4) % 253) + 1;
+        const UInt256 A(toFieldElement(a));
+        const UInt256 B(toFieldElement(b));
+
+        REQUIRE((A / B).toField() == toFieldElement(a / b));
+        REQUIRE((A % B).toField() == toFieldElement(a % b));
+        REQUIRE((A < B) == (a < b));
+        REQUIRE((A == B) == (a == b));
+
+        // The full product divided by one of the factors
+        const UInt512 product = A.mul(B);
+        UInt512 quotient;
+        UInt256 remainder;
+        product.divide(B, quotient, remainder);
+        REQUIRE(quotient.toField() == A.toField());
+        REQUIRE(remainder.isZero());
+
+        const BigInt c = getRandomFieldElementAsBigInt(120);
+        const BigInt d = getRandomFieldElementAsBigInt(120);
+        REQUIRE((UInt256(toFieldElement(c)) * UInt256(toFieldElement(d))).toField() == toFieldElement(c * d));
+    }
+}
+
+TEST_CASE("PublicData", "[PublicDataGadget]")
+{
+    // The padding fits in the last block or needs an extra block
+    for (unsigned int numBytes : {1, 55, 56, 64, 68 * 3 + 5})
+    {
+        protoboard<FieldT> pb;
+        PublicDataGadget publicData(pb, "publicData");
+        VariableArrayT bits = make_var_array(pb, numBytes * 8, "bits");
+        publicData.add(bits);
+        publicData.generate_r1cs_constraints();
+
+        for (unsigned int i = 0; i < bits.size(); i++)
+        {
+            pb.val(bits[i]) = FieldT(rand() % 2);
+        }
+        REQUIRE(publicData.generate_r1cs_witness());
+        REQUIRE(pb.is_satisfied());
+
+        // Data that isn't made out of bits is rejected
+        pb.val(bits[0]) = FieldT(2);
+        REQUIRE(!publicData.generate_r1cs_witness());
+    }
+}
@@ -90,8 +90,8 @@ TEST_CASE("UpdateAccount", "[UpdateAccountGadget]")
     SECTION("Incorrect proof")
     {
         AccountUpdate modifiedAccountUpdate = accountUpdate;
-        unsigned int randomIndex = rand() % modifiedAccountUpdate.proof.data.size();
-        modifiedAccountUpdate.proof.data[randomIndex] += 1;
+        unsigned int randomIndex = rand() % modifiedAccountUpdate.proof.size();
+        modifiedAccountUpdate.proof.set(randomIndex, modifiedAccountUpdate.proof[randomIndex] + 1);
         updateAccountChecked(modifiedAccountUpdate, false);
     }
 }
@@ -153,8 +153,8 @@ TEST_CASE("UpdateBalance", "[UpdateBalanceGadget]")
     SECTION("Incorrect proof")
     {
         BalanceUpdate modifiedBalanceUpdate = balanceUpdate;
-        unsigned int randomIndex = rand() % modifiedBalanceUpdate.proof.data.size();
-        modifiedBalanceUpdate.proof.data[randomIndex] += 1;
+        unsigned int randomIndex = rand() % modifiedBalanceUpdate.proof.size();
+        modifiedBalanceUpdate.proof.set(randomIndex, modifiedBalanceUpdate.proof[randomIndex] + 1);
         updateBalanceChecked(modifiedBalanceUpdate, false);
     }
 }
@@ -217,8 +217,79 @@ TEST_CASE("UpdateStorage", "[UpdateStorageGadget]")
     SECTION("Incorrect proof")
     {
         StorageUpdate modifiedStorageUpdate = storageUpdate;
-        unsigned int randomIndex = rand() % modifiedStorageUpdate.proof.data.size();
-        modifiedStorageUpdate.proof.data[randomIndex] += 1;
+        unsigned int randomIndex = rand() % modifiedStorageUpdate.proof.size();
+        modifiedStorageUpdate.proof.set(randomIndex, modifiedStorageUpdate.proof[randomIndex] + 1);
         updateStorageChecked(modifiedStorageUpdate, false);
     }
 }
+
+TEST_CASE("Hash witness cache", "[CachedHashGadget]")
+{
+    Block block = getBlock();
+    const UniversalTransaction &tx = getSpotTrade(block);
+    const BalanceUpdate &balanceUpdate = tx.witness.balanceUpdateB_B;
+
+    auto updateBalance = [&]() {
+        protoboard<FieldT> pb;
+
+        pb_variable<FieldT> rootBefore = make_variable(pb, "rootBefore");
+        VariableArrayT address = make_var_array(pb, NUM_BITS_TOKEN, ".address");
+        BalanceState stateBefore = createBalanceState(pb, balanceUpdate.before);
+        BalanceState stateAfter = createBalanceState(pb, balanceUpdate.after);
+        address.fill_with_bits_of_field_element(pb, balanceUpdate.tokenID);
+        pb.val(rootBefore) = balanceUpdate.rootBefore;
+
+        UpdateBalanceGadget updateBalance(pb, rootBefore, address, stateBefore, stateAfter, "updateBalance");
+        updateBalance.generate_r1cs_constraints();
+        updateBalance.generate_r1cs_witness(balanceUpdate);
+        REQUIRE(pb.is_satisfied());
+        return pb.full_variable_assignment();
+    };
+
+    WitnessCache &cache = WitnessCache::getInstance();
+    cache.clear();
+    auto computed = updateBalance();
+    REQUIRE(cache.getMisses() > 0);
+
+    cache.resetStatistics();
+    auto cached = updateBalance();
+    REQUIRE(cache.getMisses() == 0);
+    REQUIRE(cache.getHitRate() == 1.0);
+    REQUIRE(cached == computed);
+}
+
+template <typename HashT, typename NativeT> void checkNativeHashGadget(unsigned int numInputs)
+{
+    protoboard<FieldT> pb;
+    std::vector<std::unique_ptr<NativeHashGadget<HashT, NativeT>>> gadgets;
+    std::vector<NativeHashGadget<HashT, NativeT> *> batch;
+    for (unsigned int i = 0; i < NativeT::BATCH_SIZE + 3; i++)
+    {
+        VariableArrayT inputs = make_var_array(pb, numInputs, ".inputs");
+        for (unsigned int j = 0; j < numInputs; j++)
+        {
+            pb.val(inputs[j]) = getRandomFieldElement();
+        }
+        gadgets.emplace_back(new NativeHashGadget<HashT, NativeT>(pb, inputs, "hash"));
+        batch.push_back(gadgets.back().get());
+    }
+    // The native permutation writes every variable of the hash gadgets
+    NativeHashGadget<HashT, NativeT>::generate_r1cs_witness(batch);
+    auto native = pb.full_variable_assignment();
+
+    for (auto &gadget : gadgets)
+    {
+        gadget->hash.generate_r1cs_witness();
+    }
+    REQUIRE(pb.full_variable_assignment() == native);
+}
+
+TEST_CASE("Native hash witness", "[NativeHashGadget]")
+{
+    checkNativeHashGadget<Poseidon_4, NativePoseidon_4>(4);
+    checkNativeHashGadget<Poseidon_6, NativePoseidon_6>(6);
+    checkNativeHashGadget<Poseidon_4_<3>, NativePoseidon_4>(3);
+    checkNativeHashGadget<Poseidon_4_<2>, NativePoseidon_4>(2);
+    // EdDSA hash_RAM
+    checkNativeHashGadget<Poseidon_5, NativePoseidon_5>(5);
+}
@@ -23,7 +23,7 @@ TEST_CASE("Order", "[OrderGadget]")
     const UniversalTransaction &tx = getSpotTrade(block);
 
     const FieldT &exchange = block.exchange;
-    const Order &order = tx.spotTrade.orderA;
+    const Order &order = tx.getSpotTrade().orderA;
 
     const AccountLeaf &account2 = tx.witness.accountUpdate_B.before;
 
@@ -0,0 +1,89 @@
+#include "../ThirdParty/catch.hpp"
+#include "TestUtils.h"
+
+#include "../Gadgets/MathGadgets.h"
+#include "../Utils/NativeMerkleTree.h"
+
+template <typename HashT, typename NativeHashT> void checkNativePoseidon(unsigned int numInputs)
+{
+    for (unsigned int n = 0; n < 3; n++)
+    {
+        // Batches of different sizes, also larger than a single batch
+        const unsigned int count = (n == 0) ? 1 : NativeHashT::BATCH_SIZE * n + 3;
+        std::vector<FieldT> inputs;
+        std::vector<FieldT> expected;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            protoboard<FieldT> pb;
+            VariableArrayT variables = make_var_array(pb, numInputs, ".inputs");
+            for (unsigned int j = 0; j < numInputs; j++)
+            {
+                inputs.push_back(getRandomFieldElement());
+                pb.val(variables[j]) = inputs.back();
+            }
+            HashT hash(pb, variables, "hash");
+            hash.generate_r1cs_witness();
+            expected.push_back(pb.val(hash.result()));
+        }
+
+        std::vector<FieldT> results(count);
+        NativeHashT::hash(inputs.data(), numInputs, count, results.data());
+        REQUIRE(results == expected);
+    }
+}
+
+TEST_CASE("NativePoseidon", "[NativePoseidon]")
+{
+    SECTION("Same as the gadget")
+    {
+        checkNativePoseidon<Poseidon_4, NativePoseidon_4>(4);
+        checkNativePoseidon<Poseidon_4_<3>, NativePoseidon_4>(3);
+        checkNativePoseidon<Poseidon_5, NativePoseidon_5>(5);
+        checkNativePoseidon<Poseidon_6, NativePoseidon_6>(6);
+        checkNativePoseidon<Poseidon_2, NativePoseidon_2>(2);
+    }
+
+    SECTION("Merkle roots of a block")
+    {
+        Block block = getBlock();
+
+        MerkleRootBatch accounts(TREE_DEPTH_ACCOUNTS);
+        MerkleRootBatch balances(TREE_DEPTH_TOKENS);
+        std::vector<std::pair<size_t, const AccountUpdate *>> accountUpdates;
+        std::vector<std::pair<size_t, const BalanceUpdate *>> balanceUpdates;
+        for (const UniversalTransaction &tx : block.transactions)
+        {
+            const Witness &witness = tx.witness;
+            for (const AccountUpdate *update :
+                 {&witness.accountUpdate_A, &witness.accountUpdate_B, &witness.accountUpdate_O})
+            {
+                accountUpdates.push_back(
+                  {accounts.add(hashLeaf(update->before), toAddress(update->accountID), update->proof), update});
+            }
+            for (const BalanceUpdate *update :
+                 {&witness.balanceUpdateS_A,
+                  &witness.balanceUpdateB_A,
+                  &witness.balanceUpdateS_B,
+                  &witness.balanceUpdateB_B,
+                  &witness.balanceUpdateA_P,
+                  &witness.balanceUpdateB_P,
+                  &witness.balanceUpdateA_O,
+                  &witness.balanceUpdateB_O})
+            {
+                balanceUpdates.push_back(
+                  {balances.add(hashLeaf(update->before), toAddress(update->tokenID), update->proof), update});
+            }
+        }
+        accounts.compute();
+        balances.compute();
+
+        for (const auto &update : accountUpdates)
+        {
+            REQUIRE(accounts.getRoot(update.first) == update.second->rootBefore);
+        }
+        for (const auto &update : balanceUpdates)
+        {
+            REQUIRE(balances.getRoot(update.first) == update.second->rootBefore);
+        }
+    }
+}
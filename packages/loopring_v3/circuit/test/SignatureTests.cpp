@@ -134,6 +134,47 @@ TEST_CASE("SignatureVerifier", "[SignatureVerifier]")
     }
 }
 
+TEST_CASE("SignatureVerifier witness cache", "[SignatureVerifier]")
+{
+    Block block = getBlock();
+    const Witness &witness = block.transactions[0].witness;
+
+    auto verifySignature = [&](bool required) {
+        protoboard<FieldT> pb;
+
+        Constants constants(pb, "constants");
+        jubjub::Params params;
+        jubjub::VariablePointT publicKey(pb, "publicKey");
+        pb.val(publicKey.x) = witness.accountUpdate_A.before.publicKey.x;
+        pb.val(publicKey.y) = witness.accountUpdate_A.before.publicKey.y;
+        pb_variable<FieldT> message = make_variable(pb, 0, "message");
+        pb_variable<FieldT> requireValid = make_variable(pb, required ? 1 : 0, "requireValid");
+
+        SignatureVerifier signatureVerifier(
+          pb, params, constants, publicKey, message, requireValid, "signatureVerifier");
+        signatureVerifier.generate_r1cs_constraints();
+        signatureVerifier.generate_r1cs_witness(witness.signatureA);
+        REQUIRE(pb.is_satisfied() == !required);
+        return pb.full_variable_assignment();
+    };
+
+    WitnessCache &cache = SignatureVerifier::getWitnessCache();
+    cache.clear();
+    auto computed = verifySignature(false);
+    REQUIRE(cache.getMisses() == 1);
+
+    // The same signature that isn't required again
+    cache.resetStatistics();
+    auto cached = verifySignature(false);
+    REQUIRE(cache.getHits() == 1);
+    REQUIRE(cached == computed);
+
+    // Required signatures are always verified
+    cache.resetStatistics();
+    verifySignature(true);
+    REQUIRE(cache.getHits() + cache.getMisses() == 0);
+}
+
 TEST_CASE("CompressPublicKey", "[CompressPublicKey]")
 {
     auto compressPublicKeyChecked = [](const FieldT &_pubKeyX, const FieldT &_pubKeyY, bool checkValid = false) {
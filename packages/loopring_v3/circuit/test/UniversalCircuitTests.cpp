@@ -0,0 +1,253 @@
+#include "../ThirdParty/catch.hpp"
+#include "TestUtils.h"
+
+#include "../Circuits/UniversalCircuit.h"
+#include "../Utils/BlockDecoder.h"
+#include "../Utils/ConstraintSystem.h"
+
+TEST_CASE("Dummy transaction witness cache", "[TransactionGadget]")
+{
+    Block block = getBlock();
+
+    auto generateWitness = [&]() {
+        protoboard<FieldT> pb;
+        UniversalCircuit circuit(pb, "circuit");
+        circuit.generateConstraints(block.transactions.size());
+        REQUIRE(circuit.generateWitness(block));
+        REQUIRE(pb.is_satisfied());
+        return pb.full_variable_assignment();
+    };
+
+    WitnessCache &cache = TransactionGadget::getDummyWitnessCache();
+    cache.clear();
+    auto computed = generateWitness();
+    REQUIRE(cache.getMisses() > 0);
+
+    // All transaction circuits that only process dummy data reuse the witness now
+    cache.resetStatistics();
+    auto cached = generateWitness();
+    REQUIRE(cache.getMisses() == 0);
+    REQUIRE(cache.getHits() > 0);
+    REQUIRE(cached == computed);
+}
+
+TEST_CASE("Unsatisfied constraint transaction", "[UniversalCircuit]")
+{
+    Block block = getBlock();
+    protoboard<FieldT> pb;
+    UniversalCircuit circuit(pb, "circuit");
+    circuit.generateConstraints(block.transactions.size());
+    REQUIRE(circuit.generateWitness(block));
+
+    uint64_t unsatisfied = 0;
+    REQUIRE(isSatisfied(pb, &unsatisfied));
+    REQUIRE(circuit.getTransactionIndex(0) == -1);
+
+    pb.val(circuit.transactions[2].newAccountsRoot) += FieldT::one();
+    REQUIRE(!isSatisfied(pb, &unsatisfied));
+    REQUIRE(circuit.getTransactionIndex(getMaxVariable(pb, unsatisfied)) == 2);
+}
+
+TEST_CASE("Transaction templates", "[UniversalCircuit]")
+{
+    Block block = getBlock();
+    REQUIRE(block.transactions.size() > 1);
+
+    // The constraints of all slots copied from a template, and every slot built separately
+    protoboard<FieldT> pbTemplates;
+    UniversalCircuit circuitTemplates(pbTemplates, "circuit");
+    circuitTemplates.build(block.transactions.size(), true, true);
+    protoboard<FieldT> pbSlots;
+    UniversalCircuit circuitSlots(pbSlots, "circuit");
+    circuitSlots.build(block.transactions.size(), true, false);
+
+    REQUIRE(pbTemplates.num_variables() == pbSlots.num_variables());
+    REQUIRE(pbTemplates.num_inputs() == pbSlots.num_inputs());
+    REQUIRE(pbTemplates.num_constraints() == pbSlots.num_constraints());
+    auto equal = [](const libsnark::linear_combination<FieldT> &a, const libsnark::linear_combination<FieldT> &b) {
+        if (a.getTerms().size() != b.getTerms().size())
+        {
+            return false;
+        }
+        for (size_t t = 0; t < a.getTerms().size(); t++)
+        {
+            if (a.getTerms()[t].index != b.getTerms()[t].index ||
+                a.getTerms()[t].getCoeff() != b.getTerms()[t].getCoeff())
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    const auto &constraintsTemplates = pbTemplates.constraint_system.constraints;
+    const auto &constraintsSlots = pbSlots.constraint_system.constraints;
+    for (size_t i = 0; i < constraintsTemplates.size(); i++)
+    {
+        INFO("constraint " << i);
+        REQUIRE(equal(constraintsTemplates[i]->getA(), constraintsSlots[i]->getA()));
+        REQUIRE(equal(constraintsTemplates[i]->getB(), constraintsSlots[i]->getB()));
+        REQUIRE(equal(constraintsTemplates[i]->getC(), constraintsSlots[i]->getC()));
+    }
+
+    // And both give the same witness
+    REQUIRE(circuitTemplates.generateWitness(block));
+    REQUIRE(circuitSlots.generateWitness(block));
+    REQUIRE(pbTemplates.full_variable_assignment() == pbSlots.full_variable_assignment());
+    REQUIRE(pbTemplates.is_satisfied());
+}
+
+// FNV-1a over the variables and coefficients of the constraints [begin, end)
+static uint64_t hashConstraints(const protoboard<FieldT> &pb, size_t begin, size_t end)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](const void *data, size_t size) {
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ ((const uint8_t *)data)[i]) * 1099511628211ULL;
+        }
+    };
+    auto addTerms = [&add](const libsnark::linear_combination<FieldT> &lc) {
+        const uint64_t numTerms = lc.getTerms().size();
+        add(&numTerms, sizeof(numTerms));
+        for (const auto &term : lc.getTerms())
+        {
+            const uint64_t index = term.index;
+            const auto coefficient = term.getCoeff().as_bigint();
+            add(&index, sizeof(index));
+            add(coefficient.data, sizeof(coefficient.data));
+        }
+    };
+    for (size_t i = begin; i < end; i++)
+    {
+        addTerms(pb.constraint_system.constraints[i]->getA());
+        addTerms(pb.constraint_system.constraints[i]->getB());
+        addTerms(pb.constraint_system.constraints[i]->getC());
+    }
+    return hash;
+}
+
+TEST_CASE("Transaction layout", "[UniversalCircuit]")
+{
+    Block block = getBlock();
+    protoboard<FieldT> pb;
+    UniversalCircuit circuit(pb, "circuit");
+    circuit.generateConstraints(block.transactions.size());
+
+    // The transactions built directly on a protoboard with the same variables before them,
+    // the way the circuit used to build them
+    protoboard<FieldT> pbDirect;
+    make_var_array(pbDirect, circuit.transactions[0].offset - 1, "circuit");
+    std::vector<std::unique_ptr<TransactionGadget>> transactions;
+    for (size_t j = 0; j < block.transactions.size(); j++)
+    {
+        transactions.emplace_back(new TransactionGadget(
+          pbDirect,
+          circuit.params,
+          circuit.constants,
+          circuit.exchange.packed,
+          (j == 0) ? circuit.merkleRootBefore.packed : transactions.back()->getNewAccountsRoot(),
+          circuit.timestamp.packed,
+          circuit.protocolTakerFeeBips.packed,
+          circuit.protocolMakerFeeBips.packed,
+          circuit.operatorAccountID.bits,
+          (j == 0) ? circuit.accountBefore_P.balancesRoot : transactions.back()->getNewProtocolBalancesRoot(),
+          (j == 0) ? circuit.constants._0 : transactions.back()->tx.getOutput(TXV_NUM_CONDITIONAL_TXS),
+          std::string("tx_") + std::to_string(j)));
+        transactions.back()->generate_r1cs_constraints();
+    }
+
+    // Same variables, same outputs and the same constraints
+    REQUIRE(pbDirect.num_variables() + 1 == circuit.transactionsEnd);
+    for (size_t j = 0; j < block.transactions.size(); j++)
+    {
+        REQUIRE(circuit.transactions[j].newAccountsRoot.index == transactions[j]->getNewAccountsRoot().index);
+        REQUIRE(
+          circuit.transactions[j].newProtocolBalancesRoot.index ==
+          transactions[j]->getNewProtocolBalancesRoot().index);
+        REQUIRE(
+          circuit.transactions[j].numConditionalTransactionsAfter.index ==
+          transactions[j]->tx.getOutput(TXV_NUM_CONDITIONAL_TXS).index);
+    }
+    REQUIRE(
+      circuit.transactionConstraintsEnd - circuit.transactionConstraintsBegin == pbDirect.num_constraints());
+    REQUIRE(
+      hashConstraints(pb, circuit.transactionConstraintsBegin, circuit.transactionConstraintsEnd) ==
+      hashConstraints(pbDirect, 0, pbDirect.num_constraints()));
+}
+
+TEST_CASE("Streamed witness", "[UniversalCircuit]")
+{
+    Block block = getBlock();
+    protoboard<FieldT> pb;
+    UniversalCircuit circuit(pb, "circuit");
+    circuit.generateConstraints(block.transactions.size());
+    REQUIRE(circuit.generateWitness(block));
+    REQUIRE(pb.is_satisfied());
+    const auto expected = pb.full_variable_assignment();
+
+    // block.json has the transactions before most other block data, with the keys sorted
+    // the transactions come last so they can be streamed
+    ifstream file(string(TEST_DATA_PATH) + "block.json");
+    REQUIRE(file.is_open());
+    json input;
+    file >> input;
+    std::string data = input.dump();
+
+    protoboard<FieldT> pbStreamed;
+    UniversalCircuit circuitStreamed(pbStreamed, "circuit");
+    circuitStreamed.generateConstraints(block.transactions.size());
+    Block header;
+    BlockDecoder decoder(header);
+    unsigned int numTransactions = 0;
+    decoder.stream(
+      [&](const Block &blockHeader) { return circuitStreamed.beginWitness(blockHeader); },
+      [&](UniversalTransaction &transaction) {
+          numTransactions++;
+          return circuitStreamed.addTransactionWitness(std::move(transaction));
+      });
+    REQUIRE(decoder.decode(data));
+    REQUIRE(decoder.isStreaming());
+    REQUIRE(numTransactions == block.transactions.size());
+    REQUIRE(header.transactions.empty());
+    REQUIRE(circuitStreamed.endWitness(header));
+
+    REQUIRE(pbStreamed.full_variable_assignment() == expected);
+    REQUIRE(pbStreamed.is_satisfied());
+}
+
+TEST_CASE("Profiler", "[UniversalCircuit]")
+{
+    Block block = getBlock();
+    CircuitProfiler profiler;
+    protoboard<FieldT> pb;
+    CircuitProfiler::getActive() = &profiler;
+    UniversalCircuit circuit(pb, "circuit");
+    circuit.generateConstraints(block.transactions.size());
+    CircuitProfiler::getActive() = nullptr;
+
+    json report = profiler.report(pb);
+    REQUIRE(report["constraints"].get<size_t>() == pb.num_constraints());
+    REQUIRE(report["variables"].get<size_t>() == pb.num_variables());
+    // The block gadgets, the transactions and the gadgets of the transactions
+    REQUIRE(report["scope_depth"].get<size_t>() == 2);
+
+    // Every constraint and variable is counted exactly once: in a top level scope or unscoped
+    size_t constraints = report["unscoped"]["constraints"].get<size_t>();
+    size_t variables =
+      report["unscoped"]["variables"].get<size_t>() + report["unconstrained_variables"].get<size_t>();
+    for (const json &scope : report["scopes"])
+    {
+        constraints += scope["constraints"].get<size_t>();
+        variables += scope["variables"].get<size_t>();
+
+        // The cost of a scope includes its children
+        size_t childConstraints = 0;
+        for (const json &child : scope["children"])
+        {
+            childConstraints += child["constraints"].get<size_t>();
+        }
+        REQUIRE(childConstraints <= scope["constraints"].get<size_t>());
+    }
+    REQUIRE(constraints == pb.num_constraints());
+    REQUIRE(variables == pb.num_variables());
+}
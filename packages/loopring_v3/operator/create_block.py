@@ -15,6 +15,8 @@ class Block(object):
 
     def toJSON(self):
         self.blockSize = len(self.transactions)
+        # Put the transactions last so the prover can process them while the block is being read
+        self.transactions = self.__dict__.pop("transactions")
         data = json.dumps(self, default=lambda o: o.__dict__, sort_keys=False, indent=4)
         # Work around the reserved keyword "from" in python
         data = data.replace('"from_"','"from"')
@@ -2504,7 +2504,25 @@ export class ExchangeTestUtil {
           "http://localhost/prove?block_filename=" + block.filename;
         proveQuery += "&proof_filename=" + proofFilename;
         proveQuery += "&validate=true";
-        await this.httpGetSync(proveQuery, port);
+        const job = JSON.parse(
+          (await this.httpGetSync(proveQuery, port)) as string
+        );
+        // Wait until the proof is generated
+        let status = "queued";
+        while (status === "queued" || status === "running") {
+          await this.sleep(100);
+          const jobInfo = JSON.parse(
+            (await this.httpGetSync(
+              "http://localhost/job?id=" + job.id,
+              port
+            )) as string
+          );
+          status = jobInfo.status;
+        }
+        assert(
+          status === "done",
+          "Block proof generation failed: " + block.filename
+        );
       } else {
         // Generate the proof by starting a dedicated circuit binary app instance
         const result = childProcess.spawnSync(